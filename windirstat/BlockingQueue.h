@@ -20,28 +20,164 @@
 
 #pragma once
 
-#include <stack>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <mutex>
+#include <memory>
+#include <optional>
+#include <stop_token>
+#include <thread>
+#include <vector>
 #include <condition_variable>
 #include <functional>
 
+#include "RateLimiter.h"
+
+//
+// BlockingQueue. A work-stealing queue shared by a fixed set of worker threads.
+// Each worker pushes to and pops from the front of its own deque, so the lock
+// guarding it is only contended when another worker steals from its back.
+// Slot zero holds items pushed from threads that are not workers of the queue.
+// Items the owner marks as priority go to a separate shared deque that all
+// workers drain before their own; Reprioritize() moves queued items between
+// the two when the owner's notion of priority changes.  The number of workers
+// taking items can be lowered at runtime; the others stay parked until the
+// limit is raised again.  Cancellation is cooperative: once cancelled, Pop()
+// returns a default constructed item and the waiting functions return false
+// so that workers unwind through their loops instead of by exception.
+//
 template <typename T>
 class BlockingQueue final
 {
+    struct WorkerQueue final
+    {
+        std::mutex m_Mutex;
+        std::deque<T> m_Queue;
+    };
+
     std::vector<std::thread> m_Threads;
-    std::deque<T> m_Queue;
+    std::vector<std::unique_ptr<WorkerQueue>> m_WorkerQueues;
+    WorkerQueue m_PriorityQueue;
+    std::function<bool(const T&)> m_IsPriority;
+    std::vector<BlockingQueue*> m_StealGroup;
     std::mutex m_Mutex;
     std::condition_variable m_Pushed;
     std::condition_variable m_Waiting;
+    std::atomic<size_t> m_Queued = 0;
+    std::atomic<size_t> m_PriorityQueued = 0;
+    std::atomic<unsigned int> m_Active = 0;
+    std::atomic<unsigned int> m_Sleeping = 0;
+    std::atomic<unsigned int> m_Concurrency = UINT_MAX;
+    std::atomic<ULONGLONG> m_BusyMicroseconds = 0;
+    std::atomic<ULONGLONG> m_Completed = 0;
     unsigned int m_TotalWorkerThreads = 1;
-    unsigned int m_WorkersWaiting = 0;
-    bool m_Started = false;
-    bool m_Suspended = false;
-    bool m_Cancelled = false;
+    std::atomic<bool> m_Started = false;
+    std::atomic<bool> m_Suspended = false;
+    std::stop_source m_StopSource;
+
+    // Identity of the worker running on this thread and the queue that
+    // owns the item it is currently processing (differs if it was stolen)
+    inline static thread_local BlockingQueue* m_WorkerHome = nullptr;
+    inline static thread_local size_t m_WorkerIndex = 0;
+    inline static thread_local BlockingQueue* m_WorkerItemQueue = nullptr;
+    inline static thread_local std::chrono::steady_clock::time_point m_WorkerItemStart;
 
     bool AllThreadsIdling() const
     {
-        return m_TotalWorkerThreads == m_WorkersWaiting;
+        return m_Active == 0;
+    }
+
+    bool IsParked() const
+    {
+        return m_WorkerHome == this && m_WorkerIndex > m_Concurrency;
+    }
+
+    bool IsFinished() const
+    {
+        // Queued count must be read first as items move to active before leaving the queue
+        return m_Started && m_Queued == 0 && m_Active == 0;
+    }
+
+    bool CanSteal() const
+    {
+        // Items of other queues are taken once all work for this queue is done
+        return IsFinished() && std::ranges::any_of(m_StealGroup, [](const auto queue)
+        {
+            return queue->m_Started && !queue->m_Suspended && queue->m_Queued > 0;
+        });
+    }
+
+    std::optional<T> TryPop(WorkerQueue& worker, const bool steal)
+    {
+        std::lock_guard lock(worker.m_Mutex);
+        if (m_Suspended || worker.m_Queue.empty()) return std::nullopt;
+
+        // Owners take the most recent item; thieves take the oldest
+        T value = steal ? std::move(worker.m_Queue.back()) : std::move(worker.m_Queue.front());
+        if (steal) worker.m_Queue.pop_back();
+        else worker.m_Queue.pop_front();
+
+        // Record as active before leaving the queue so completion is never seen early
+        m_Active++;
+        m_Queued--;
+        if (&worker == &m_PriorityQueue) m_PriorityQueued--;
+        m_Started = true;
+        return value;
+    }
+
+    std::optional<T> TryPopAny(const size_t start)
+    {
+        if (m_Queued == 0) return std::nullopt;
+        if (m_PriorityQueued > 0)
+        {
+            if (auto value = TryPop(m_PriorityQueue, false); value.has_value()) return value;
+        }
+
+        for (size_t i = 0; i < m_WorkerQueues.size(); i++)
+        {
+            const size_t index = (start + i) % m_WorkerQueues.size();
+            const bool own = m_WorkerHome == this && index == m_WorkerIndex;
+            if (auto value = TryPop(*m_WorkerQueues[index], !own); value.has_value()) return value;
+        }
+        return std::nullopt;
+    }
+
+    void CompleteItem()
+    {
+        // Previous item taken by this thread is done; wake anyone waiting on idle
+        BlockingQueue* queue = m_WorkerItemQueue;
+        if (queue == nullptr) return;
+        m_WorkerItemQueue = nullptr;
+        queue->m_BusyMicroseconds += std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - m_WorkerItemStart).count();
+        queue->m_Completed++;
+        if (--queue->m_Active == 0)
+        {
+            // Sleeping workers may now steal from the other queues
+            std::lock_guard lock(queue->m_Mutex);
+            queue->m_Waiting.notify_all();
+            if (!queue->m_StealGroup.empty()) queue->m_Pushed.notify_all();
+        }
+    }
+
+    void JoinThreads()
+    {
+        for (auto& thread : m_Threads)
+        {
+            if (thread.joinable()) thread.join();
+        }
+    }
+
+    void SignalCancel()
+    {
+        {
+            std::lock_guard lock(m_Mutex);
+            m_StopSource.request_stop();
+        }
+        m_Waiting.notify_all();
+        m_Pushed.notify_all();
     }
 
 public:
@@ -50,21 +186,20 @@ public:
     BlockingQueue& operator=(const BlockingQueue&) = delete;
     BlockingQueue& operator=(BlockingQueue&&) = delete;
     ~BlockingQueue() = default;
-    BlockingQueue() = default;
+    BlockingQueue()
+    {
+        m_WorkerQueues.emplace_back(std::make_unique<WorkerQueue>());
+    }
 
-    void ThreadWrapper(const std::function<void()> & callback)
+    void ThreadWrapper(const std::function<void()> & callback, const size_t index)
     {
-        try
-        {
-            callback();
-        }
-        catch (std::exception&)
-        {
-            // caught from long running or cancelled
-            std::lock_guard lock(m_Mutex);
-            m_WorkersWaiting++;
-            m_Waiting.notify_all();
-        }
+        m_WorkerHome = this;
+        m_WorkerIndex = index;
+
+        callback();
+
+        CompleteItem();
+        m_WorkerHome = nullptr;
     }
 
     void StartThreads(const unsigned int workerThreads, const std::function<void()> & callback)
@@ -73,98 +208,275 @@ public:
 
         for (auto worker = 0u; worker < m_TotalWorkerThreads; worker++)
         {
-            m_Threads.emplace_back(&BlockingQueue::ThreadWrapper, this, callback);
+            m_Threads.emplace_back(&BlockingQueue::ThreadWrapper, this, callback, worker + 1);
         }
     }
 
-    void Push(T const& value)
+    void SetStealGroup(const std::vector<BlockingQueue*>& group)
+    {
+        // Other queues whose items our workers may take once this queue is finished
+        m_StealGroup.clear();
+        std::ranges::copy_if(group, std::back_inserter(m_StealGroup),
+            [this](const auto queue) { return queue != this; });
+    }
+
+    void SetPriority(const std::function<bool(const T&)>& isPriority)
+    {
+        // Called before the workers are started; the predicate is evaluated
+        // by the workers whenever they push
+        m_IsPriority = isPriority;
+    }
+
+    void Reprioritize()
     {
-        // Push another entry onto the queue
+        // Re-evaluate the priority of queued items after the predicate changed;
+        // the worker deques are only resized while holding the shared lock
+        if (m_IsPriority == nullptr) return;
+        std::lock_guard queueLock(m_Mutex);
+        std::vector<T> promoted;
+        for (const auto& worker : m_WorkerQueues)
+        {
+            std::lock_guard lock(worker->m_Mutex);
+            const auto removed = std::ranges::stable_partition(worker->m_Queue,
+                [this](const T& value) { return !m_IsPriority(value); });
+            std::ranges::move(removed, std::back_inserter(promoted));
+            worker->m_Queue.erase(removed.begin(), removed.end());
+        }
+
+        std::vector<T> demoted;
+        {
+            std::lock_guard lock(m_PriorityQueue.m_Mutex);
+            const auto removed = std::ranges::stable_partition(m_PriorityQueue.m_Queue, m_IsPriority);
+            std::ranges::move(removed, std::back_inserter(demoted));
+            m_PriorityQueue.m_Queue.erase(removed.begin(), removed.end());
+            std::ranges::move(promoted, std::back_inserter(m_PriorityQueue.m_Queue));
+            m_PriorityQueued = m_PriorityQueue.m_Queue.size();
+        }
+
+        if (demoted.empty()) return;
+        std::lock_guard lock(m_WorkerQueues[0]->m_Mutex);
+        std::ranges::move(demoted, std::back_inserter(m_WorkerQueues[0]->m_Queue));
+    }
+
+    void SetConcurrency(const unsigned int workers)
+    {
+        // Workers beyond the limit finish their current item and then park; a
+        // queue left without any workers only progresses through stealing
         std::lock_guard lock(m_Mutex);
-        m_Queue.push_front(value);
-        m_Pushed.notify_one();
+        m_Concurrency = workers;
+        m_Pushed.notify_all();
     }
 
-    T Pop()
+    unsigned int GetConcurrency() const
     {
-        // Record the worker is m_Waiting for an item until
-        // the queue has something in it and we are not suspended
-        std::unique_lock lock(m_Mutex);
-        m_WorkersWaiting++;
-        m_Waiting.notify_all();
-        m_Pushed.wait(lock, [&]
+        return std::min(m_Concurrency.load(), m_TotalWorkerThreads);
+    }
+
+    size_t GetQueuedCount() const
+    {
+        return m_Queued;
+    }
+
+    unsigned int GetActiveCount() const
+    {
+        return m_Active;
+    }
+
+    std::pair<ULONGLONG, ULONGLONG> TakeLatencySample()
+    {
+        // Processing time in microseconds and number of items completed since the last sample
+        return { m_BusyMicroseconds.exchange(0), m_Completed.exchange(0) };
+    }
+
+    BlockingQueue* GetItemQueue()
+    {
+        // Queue owning the item the calling worker is processing
+        return m_WorkerItemQueue != nullptr ? m_WorkerItemQueue : this;
+    }
+
+    void Push(T const& value)
+    {
+        // Push another entry onto the queue of the calling worker
+        const bool priority = m_IsPriority != nullptr && m_IsPriority(value);
+        auto& worker = priority ? m_PriorityQueue : *m_WorkerQueues[m_WorkerHome == this ? m_WorkerIndex : 0];
         {
-            return !m_Suspended && !m_Queue.empty() || m_Cancelled;
-        });
-        m_WorkersWaiting--;
+            std::lock_guard lock(worker.m_Mutex);
+            worker.m_Queue.push_front(value);
+            if (priority) m_PriorityQueued++;
+        }
 
-        if (m_Cancelled)
+        // Only take the shared lock if there is someone to wake up
+        m_Queued++;
+        if (m_Sleeping > 0)
         {
-            // Mark we are in waiting mode again and abort
-            throw std::exception(__FUNCTION__);
+            std::lock_guard lock(m_Mutex);
+            m_Pushed.notify_one();
         }
 
-        // Worker now has something to work on so pop it off the queue
-        m_Started = true;
-        T i = m_Queue.front();
-        m_Queue.pop_front();
-        return i;
+        // Idle workers of finished queues in the group can take this item
+        for (const auto& queue : m_StealGroup)
+        {
+            if (queue->m_Sleeping == 0 || !queue->IsFinished()) continue;
+            std::lock_guard lock(queue->m_Mutex);
+            queue->m_Pushed.notify_all();
+        }
+    }
+
+    T Pop()
+    {
+        // The item previously popped by this worker is now complete
+        CompleteItem();
+
+        while (true)
+        {
+            if (IsCancelled())
+            {
+                return T{};
+            }
+
+            // Try our own deque first and then steal from the other workers
+            const size_t start = m_WorkerHome == this ? m_WorkerIndex : 0;
+            if (!IsParked())
+            {
+                if (auto value = TryPopAny(start); value.has_value())
+                {
+                    m_WorkerItemQueue = this;
+                    m_WorkerItemStart = std::chrono::steady_clock::now();
+                    return std::move(value.value());
+                }
+            }
+
+            // Help out other volumes once all work for this queue is done
+            if (CanSteal() && !m_Suspended && !IsParked()) for (const auto& queue : m_StealGroup)
+            {
+                if (!queue->m_Started) continue;
+                if (auto value = queue->TryPopAny(start); value.has_value())
+                {
+                    m_WorkerItemQueue = queue;
+                    m_WorkerItemStart = std::chrono::steady_clock::now();
+                    return std::move(value.value());
+                }
+            }
+
+            // Wait until something is pushed to this queue or, once it is finished,
+            // to another queue of the group; pushes there wake us up as well
+            std::unique_lock lock(m_Mutex);
+            m_Sleeping++;
+            m_Pushed.wait(lock, [&]
+            {
+                return !m_Suspended && !IsParked() && (m_Queued > 0 || CanSteal()) || IsCancelled();
+            });
+            m_Sleeping--;
+        }
     }
 
     void PushIfNotQueued(T const& value)
     {
+        for (const auto& worker : m_WorkerQueues)
+        {
+            std::lock_guard lock(worker->m_Mutex);
+            if (std::ranges::find(worker->m_Queue, value) != worker->m_Queue.end()) return;
+        }
+        {
+            std::lock_guard lock(m_PriorityQueue.m_Mutex);
+            if (std::ranges::find(m_PriorityQueue.m_Queue, value) != m_PriorityQueue.m_Queue.end()) return;
+        }
+
+        {
+            std::lock_guard lock(m_WorkerQueues[0]->m_Mutex);
+            m_WorkerQueues[0]->m_Queue.push_back(value);
+        }
+
+        m_Queued++;
         std::lock_guard lock(m_Mutex);
-        if (std::ranges::find(m_Queue, value) != m_Queue.end()) return;
-        m_Queue.push_back(value);
         m_Pushed.notify_one();
     }
 
-    void WaitIfSuspended()
+    bool IsCancelled() const
     {
-        if (!m_Suspended) return;
+        return m_StopSource.stop_requested();
+    }
+
+    std::stop_token GetStopToken() const
+    {
+        // For loops that run without access to the queue
+        return m_StopSource.get_token();
+    }
+
+    bool WaitIfSuspended()
+    {
+        // Returns false if the current task should stop as it was cancelled
+        if (!m_Suspended) return !IsCancelled();
 
         // wait until its not suspended or its cancelled
         std::unique_lock lock(m_Mutex);
-        m_WorkersWaiting++;
+        m_Active--;
         m_Waiting.notify_all();
         m_Waiting.wait(lock, [&]
         {
-            return !m_Suspended || m_Cancelled;
+            return !m_Suspended || IsCancelled();
         });
-        m_WorkersWaiting--;
+        m_Active++;
+        return !IsCancelled();
+    }
 
-        // if cancelled then throw to terminate current task
-        if (m_Cancelled)
+    bool Throttle(RateLimiter& limiter, const double tokens)
+    {
+        // Wait for the reserved tokens unless suspended or cancelled in the
+        // meantime; limits changed while suspended apply once resumed
+        const auto ready = limiter.Reserve(tokens);
+        if (ready > std::chrono::steady_clock::now())
         {
-            throw std::exception(__FUNCTION__);
+            std::unique_lock lock(m_Mutex);
+            m_Waiting.wait_until(lock, ready, [&]
+            {
+                return m_Suspended || IsCancelled();
+            });
         }
+
+        return WaitIfSuspended();
     }
 
     void WaitForCompletion()
     {
-        // Wait for all workers threads to be idled or cancelled
+        // Wait for all items to be processed or cancelled; a queue
+        // that never received any items has nothing to wait for
         std::unique_lock lock(m_Mutex);
         m_Waiting.wait(lock, [&]
         {
-            return m_Started && !m_Suspended && AllThreadsIdling() && m_Queue.empty() || m_Cancelled;
+            return (IsFinished() || !m_Started && m_Queued == 0) && !m_Suspended || IsCancelled();
         });
     }
 
-    void CancelExecution()
+    static void CancelExecution(const std::vector<BlockingQueue*>& queues)
     {
-        // Start cancellation process
-        m_Cancelled = true;
-        m_Waiting.notify_all();
-        m_Pushed.notify_all();
+        // Signal every queue before joining any since workers
+        // may be blocked on items stolen from the other queues
+        for (const auto& queue : queues)
+        {
+            queue->SignalCancel();
+        }
 
-        // Wait for threads to complete
-        for (auto& thread : m_Threads)
+        // Wait for all threads to complete so none are left
+        // stealing from a queue while it is being reset
+        for (const auto& queue : queues)
         {
-            thread.join();
+            queue->JoinThreads();
         }
 
         // Cleanup
-        ResetQueue(m_TotalWorkerThreads);
+        for (const auto& queue : queues)
+        {
+            queue->ResetQueue(queue->m_TotalWorkerThreads);
+        }
+    }
+
+    void CancelExecution()
+    {
+        // Queues that steal from each other are cancelled together
+        std::vector<BlockingQueue*> queues = m_StealGroup;
+        queues.push_back(this);
+        CancelExecution(queues);
     }
 
     bool IsSuspended() const
@@ -175,35 +487,87 @@ public:
     void SuspendExecution(const bool clearQueue = false)
     {
         if (!m_Started) return;
-        std::unique_lock lock(m_Mutex);
         m_Suspended = true;
+
+        // Cycle through the worker locks so that any pop in progress has
+        // either completed or will observe the suspension
+        for (const auto& worker : m_WorkerQueues)
+        {
+            std::lock_guard lock(worker->m_Mutex);
+        }
+        {
+            std::lock_guard lock(m_PriorityQueue.m_Mutex);
+        }
+
+        std::unique_lock lock(m_Mutex);
         m_Waiting.notify_all();
         m_Waiting.wait(lock, [&]
         {
             return AllThreadsIdling();
         });
-        if (clearQueue) m_Queue.clear();
+
+        if (clearQueue) for (const auto& worker : m_WorkerQueues)
+        {
+            std::lock_guard workerLock(worker->m_Mutex);
+            m_Queued -= worker->m_Queue.size();
+            worker->m_Queue.clear();
+        }
+        if (clearQueue)
+        {
+            std::lock_guard workerLock(m_PriorityQueue.m_Mutex);
+            m_Queued -= m_PriorityQueue.m_Queue.size();
+            m_PriorityQueue.m_Queue.clear();
+            m_PriorityQueued = 0;
+        }
     }
 
     void ResumeExecution()
     {
-        std::lock_guard lock(m_Mutex);
-        m_Suspended = false;
-        m_Waiting.notify_all();
-        m_Pushed.notify_all();
+        {
+            std::lock_guard lock(m_Mutex);
+            m_Suspended = false;
+            m_Waiting.notify_all();
+            m_Pushed.notify_all();
+        }
+
+        // Idle workers of the other queues may steal our items again
+        for (const auto& queue : m_StealGroup)
+        {
+            std::lock_guard lock(queue->m_Mutex);
+            queue->m_Pushed.notify_all();
+        }
     }
 
     void ResetQueue(const int totalWorkerThreads, const bool clearQueue = true)
     {
         std::lock_guard lock(m_Mutex);
-        m_WorkersWaiting = 0;
+        m_Active = 0;
+        m_Sleeping = 0;
         m_Suspended = false;
         m_Started = false;
-        m_Cancelled = false;
+        m_StopSource = std::stop_source();
         m_TotalWorkerThreads = totalWorkerThreads;
         m_Threads.clear();
         m_Threads.reserve(m_TotalWorkerThreads);
-        if (clearQueue) m_Queue.clear();
+
+        // Retained items are moved to the shared slot before resizing
+        auto& shared = m_WorkerQueues[0]->m_Queue;
+        for (size_t i = 1; i < m_WorkerQueues.size(); i++)
+        {
+            std::ranges::move(m_WorkerQueues[i]->m_Queue, std::back_inserter(shared));
+        }
+        m_WorkerQueues.resize(1);
+        for (auto worker = 0u; worker < m_TotalWorkerThreads; worker++)
+        {
+            m_WorkerQueues.emplace_back(std::make_unique<WorkerQueue>());
+        }
+
+        if (clearQueue)
+        {
+            shared.clear();
+            m_PriorityQueue.m_Queue.clear();
+        }
+        m_PriorityQueued = m_PriorityQueue.m_Queue.size();
+        m_Queued = shared.size() + m_PriorityQueued;
     }
 };
-
@@ -0,0 +1,139 @@
+﻿// ChangeWatcher.cpp - Implementation of ChangeWatcher
+//
+// WinDirStat - Directory Statistics
+// Copyright © WinDirStat Team
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#include "stdafx.h"
+
+#include "ChangeWatcher.h"
+#include "FileFind.h"
+#include "GlobalHelpers.h"
+#include "SmartPointer.h"
+#include "Tracer.h"
+
+#include <array>
+
+ChangeWatcher::ChangeWatcher() : m_StopEvent(CreateEvent(nullptr, TRUE, FALSE, nullptr)) {}
+
+ChangeWatcher::~ChangeWatcher()
+{
+    Stop();
+    CloseHandle(m_StopEvent);
+}
+
+void ChangeWatcher::Start(const std::vector<std::wstring>& folders)
+{
+    Stop();
+    for (const auto& folder : folders)
+    {
+        m_Threads.emplace_back([this, folder] { Watch(folder); });
+    }
+}
+
+void ChangeWatcher::Stop()
+{
+    SetEvent(m_StopEvent);
+    for (auto& thread : m_Threads) thread.join();
+    m_Threads.clear();
+    ResetEvent(m_StopEvent);
+
+    std::lock_guard lock(m_Mutex);
+    m_Changed.clear();
+    m_Overflowed.clear();
+    m_FirstChange = 0;
+}
+
+bool ChangeWatcher::IsWatching() const
+{
+    return !m_Threads.empty();
+}
+
+bool ChangeWatcher::TakeChanges(std::vector<std::wstring>& changed, std::vector<std::wstring>& overflowed)
+{
+    std::lock_guard lock(m_Mutex);
+    if (m_FirstChange == 0) return false;
+
+    // wait for a burst of changes to end unless it keeps going for too long
+    const ULONGLONG now = GetTickCount64();
+    if (now - m_LastChange < SETTLE_TIME && now - m_FirstChange < MAXIMUM_DELAY) return false;
+
+    changed.assign(m_Changed.begin(), m_Changed.end());
+    overflowed.assign(m_Overflowed.begin(), m_Overflowed.end());
+    m_Changed.clear();
+    m_Overflowed.clear();
+    m_FirstChange = 0;
+    return true;
+}
+
+void ChangeWatcher::Watch(const std::wstring& folder)
+{
+    const std::wstring path = FileFindEnhanced::MakeLongPathCompatible(folder);
+    SmartPointer<HANDLE> directory(CloseHandle, CreateFile(path.c_str(),
+        FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+        FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr));
+    SmartPointer<HANDLE> completed(CloseHandle, CreateEvent(nullptr, TRUE, FALSE, nullptr));
+    if (directory == INVALID_HANDLE_VALUE || completed == nullptr) return;
+
+    constexpr DWORD filter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME |
+        FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_ATTRIBUTES;
+    const std::wstring base = folder.back() == L'\\' ? folder : folder + L'\\';
+    const std::array<HANDLE, 2> handles = { completed, m_StopEvent };
+    // An overflow loses all changes of the read so use as large a buffer as the volume supports
+    std::vector<BYTE> buffer(IsRemoteVolume(GetVolumePathNameEx(path)) ? BUFFER_SIZE_REMOTE : BUFFER_SIZE_LOCAL);
+
+    while (true)
+    {
+        OVERLAPPED overlapped = {};
+        overlapped.hEvent = completed;
+        if (ReadDirectoryChangesW(directory, buffer.data(), static_cast<DWORD>(buffer.size()), TRUE,
+            filter, nullptr, &overlapped, nullptr) == 0)
+        {
+            VTRACE(L"Cannot watch for changes: {}", folder);
+            return;
+        }
+
+        DWORD bytes = 0;
+        if (WaitForMultipleObjects(static_cast<DWORD>(handles.size()), handles.data(), FALSE, INFINITE) != WAIT_OBJECT_0)
+        {
+            CancelIoEx(directory, &overlapped);
+            GetOverlappedResult(directory, &overlapped, &bytes, TRUE);
+            return;
+        }
+        const bool success = GetOverlappedResult(directory, &overlapped, &bytes, FALSE) != 0;
+
+        std::lock_guard lock(m_Mutex);
+        m_LastChange = GetTickCount64();
+        if (m_FirstChange == 0) m_FirstChange = m_LastChange;
+
+        // an empty result means the buffer overflowed and changes were lost;
+        // any other failure means the folder itself is no longer accessible
+        if (!success || bytes == 0)
+        {
+            m_Overflowed.insert(folder);
+            if (success || GetLastError() == ERROR_NOTIFY_ENUM_DIR) continue;
+            return;
+        }
+
+        for (auto info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(buffer.data());;
+            info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(&reinterpret_cast<const BYTE*>(info)[info->NextEntryOffset]))
+        {
+            m_Changed.insert(base + std::wstring(info->FileName, info->FileNameLength / sizeof(WCHAR)));
+            if (info->NextEntryOffset == 0) break;
+        }
+    }
+}
@@ -0,0 +1,70 @@
+﻿// ChangeWatcher.h - Declaration of ChangeWatcher
+//
+// WinDirStat - Directory Statistics
+// Copyright © WinDirStat Team
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#pragma once
+
+#include "stdafx.h"
+
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+//
+// ChangeWatcher. Collects the paths reported as changed below a set of
+// watched folders.  Each folder is watched by its own thread and the paths
+// are coalesced until no more changes have been reported for a while so a
+// burst of changes is handed out as a single batch.  Folders for which the
+// file system dropped changes are reported as overflowed.
+//
+class ChangeWatcher final
+{
+    static constexpr ULONGLONG SETTLE_TIME = 1000;    // Milliseconds without changes before a batch is handed out
+    static constexpr ULONGLONG MAXIMUM_DELAY = 10000; // Milliseconds after the first change a batch is handed out regardless
+    static constexpr DWORD BUFFER_SIZE_REMOTE = 64 * 1024;  // Largest buffer supported for network shares
+    static constexpr DWORD BUFFER_SIZE_LOCAL = 1024 * 1024; // Local volumes can take more changes before overflowing
+
+    std::mutex m_Mutex;
+    std::unordered_set<std::wstring> m_Changed;    // Full paths of the entries reported as changed
+    std::unordered_set<std::wstring> m_Overflowed; // Watched folders for which changes were lost
+    ULONGLONG m_FirstChange = 0;
+    ULONGLONG m_LastChange = 0;
+
+    std::vector<std::thread> m_Threads;
+    HANDLE m_StopEvent;
+
+    void Watch(const std::wstring& folder);
+
+public:
+
+    ChangeWatcher();
+    ~ChangeWatcher();
+
+    ChangeWatcher(const ChangeWatcher&) = delete;
+    ChangeWatcher& operator=(const ChangeWatcher&) = delete;
+
+    void Start(const std::vector<std::wstring>& folders);
+    void Stop();
+    bool IsWatching() const;
+
+    // Hands out the changes collected so far once they have settled
+    bool TakeChanges(std::vector<std::wstring>& changed, std::vector<std::wstring>& overflowed);
+};
@@ -0,0 +1,323 @@
+﻿// ChildList.h - Declaration of ChildList
+//
+// WinDirStat - Directory Statistics
+// Copyright © WinDirStat Team
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+//
+// ChildList<>. Child list of a container written by a single thread at a
+// time and read by any number of threads without locking.  Children are
+// appended to a block and published by a release store of its length.
+// Growing, sorting or removing builds a new block and publishes it as a
+// whole so readers always see a consistent snapshot.  Replaced blocks are
+// retired to a list of the writing thread and only freed once no reader that
+// could still see them remains, which readers announce with the epoch they
+// entered in; this is done by holding a View.  Views must not be passed to
+// other threads.
+//
+template <typename T>
+class ChildList final
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+
+    struct Block final
+    {
+        size_t m_Capacity;
+        std::atomic<size_t> m_Size;
+
+        T* Items()
+        {
+            return reinterpret_cast<T*>(this + 1);
+        }
+
+        static Block* Create(const size_t capacity)
+        {
+            return new (::operator new(sizeof(Block) + capacity * sizeof(T))) Block{ capacity, 0 };
+        }
+
+        static void Destroy(Block* block)
+        {
+            block->~Block();
+            ::operator delete(block);
+        }
+    };
+
+    static_assert(alignof(Block) >= alignof(T));
+
+    static constexpr size_t MIN_CAPACITY = 4;
+    static constexpr size_t RECLAIM_BATCH = 64;
+
+    using Retired = std::vector<std::pair<ULONGLONG, Block*>>;
+
+    struct ThreadState final
+    {
+        std::atomic<ULONGLONG> m_Epoch = 0; // zero while not reading
+        size_t m_Depth = 0;
+
+        // Blocks replaced by this thread; only contended by Reclaim()
+        std::mutex m_RetiredMutex;
+        Retired m_Retired;
+        size_t m_ReclaimAt = RECLAIM_BATCH;
+
+        ThreadState()
+        {
+            std::lock_guard lock(m_Mutex);
+            m_Threads.insert(this);
+        }
+
+        ~ThreadState()
+        {
+            // Blocks still visible to other readers are left for Reclaim()
+            std::lock_guard lock(m_Mutex);
+            m_Threads.erase(this);
+            std::ranges::move(m_Retired, std::back_inserter(m_Orphaned));
+        }
+
+        ThreadState(const ThreadState&) = delete;
+        ThreadState& operator=(const ThreadState&) = delete;
+    };
+
+    inline static std::mutex m_Mutex;
+    inline static std::unordered_set<ThreadState*> m_Threads;
+    inline static Retired m_Orphaned;
+    inline static std::atomic<ULONGLONG> m_GlobalEpoch = 1;
+
+    std::atomic<Block*> m_Block = nullptr;
+
+    static ThreadState& GetThread()
+    {
+        thread_local ThreadState state;
+        return state;
+    }
+
+    static void Enter()
+    {
+        if (auto& state = GetThread(); state.m_Depth++ == 0)
+        {
+            state.m_Epoch = m_GlobalEpoch.load();
+        }
+    }
+
+    static void Leave()
+    {
+        if (auto& state = GetThread(); --state.m_Depth == 0)
+        {
+            state.m_Epoch.store(0, std::memory_order_release);
+        }
+    }
+
+    void Publish(Block* block)
+    {
+        // The previous block is tagged with the epoch current after it was
+        // replaced; readers that entered in a later epoch cannot see it
+        Block* previous = m_Block.exchange(block);
+        if (previous == nullptr) return;
+
+        auto& state = GetThread();
+        {
+            std::lock_guard lock(state.m_RetiredMutex);
+            state.m_Retired.emplace_back(m_GlobalEpoch.fetch_add(1), previous);
+            if (state.m_Retired.size() < state.m_ReclaimAt) return;
+        }
+
+        // Blocks kept for readers are only rescanned once the list has doubled
+        // so that each block is looked at a bounded number of times
+        const ULONGLONG oldest = GetOldestEpoch();
+        std::lock_guard lock(state.m_RetiredMutex);
+        ReclaimRetired(state.m_Retired, oldest);
+        state.m_ReclaimAt = std::max(RECLAIM_BATCH, 2 * state.m_Retired.size());
+    }
+
+    static ULONGLONG GetOldestEpoch()
+    {
+        std::lock_guard lock(m_Mutex);
+        return GetOldestEpochLocked();
+    }
+
+    static ULONGLONG GetOldestEpochLocked()
+    {
+        ULONGLONG oldest = ULLONG_MAX;
+        for (const auto& state : m_Threads)
+        {
+            if (const ULONGLONG epoch = state->m_Epoch; epoch != 0) oldest = std::min(oldest, epoch);
+        }
+        return oldest;
+    }
+
+    static void ReclaimRetired(Retired& retired, const ULONGLONG oldest)
+    {
+        std::erase_if(retired, [oldest](const auto& entry)
+        {
+            if (entry.first >= oldest) return false;
+            Block::Destroy(entry.second);
+            return true;
+        });
+    }
+
+public:
+
+    //
+    // View. Snapshot of the list that stays valid while it is held.
+    //
+    class View final
+    {
+        const T* m_Items = nullptr;
+        size_t m_Size = 0;
+
+    public:
+
+        explicit View(const ChildList& list)
+        {
+            Enter();
+            if (Block* block = list.m_Block.load(); block != nullptr)
+            {
+                m_Size = block->m_Size.load(std::memory_order_acquire);
+                m_Items = block->Items();
+            }
+        }
+
+        View(const View& other) : m_Items(other.m_Items), m_Size(other.m_Size)
+        {
+            Enter();
+        }
+
+        View& operator=(const View&) = delete;
+
+        ~View()
+        {
+            Leave();
+        }
+
+        const T* begin() const { return m_Items; }
+        const T* end() const { return m_Items + m_Size; }
+        size_t size() const { return m_Size; }
+        bool empty() const { return m_Size == 0; }
+        const T& operator[](const size_t i) const { return m_Items[i]; }
+        const T& front() const { return m_Items[0]; }
+
+        const T& at(const size_t i) const
+        {
+            if (i >= m_Size) throw std::out_of_range(__FUNCTION__);
+            return m_Items[i];
+        }
+
+        std::vector<T> ToVector() const
+        {
+            return { begin(), end() };
+        }
+    };
+
+    ChildList() = default;
+    ChildList(const ChildList&) = delete;
+    ChildList& operator=(const ChildList&) = delete;
+
+    ~ChildList()
+    {
+        Publish(nullptr);
+    }
+
+    View GetView() const
+    {
+        return View(*this);
+    }
+
+    // Frees the retired blocks of all threads that no reader can see anymore
+    static void Reclaim()
+    {
+        std::lock_guard lock(m_Mutex);
+        const ULONGLONG oldest = GetOldestEpochLocked();
+        for (const auto& state : m_Threads)
+        {
+            std::lock_guard retiredLock(state->m_RetiredMutex);
+            ReclaimRetired(state->m_Retired, oldest);
+            state->m_ReclaimAt = std::max(RECLAIM_BATCH, 2 * state->m_Retired.size());
+        }
+        ReclaimRetired(m_Orphaned, oldest);
+    }
+
+    // The following may only be called by the thread currently writing the list
+
+    void Add(const T& value)
+    {
+        Block* block = m_Block.load(std::memory_order_relaxed);
+        const size_t size = block != nullptr ? block->m_Size.load(std::memory_order_relaxed) : 0;
+        if (block == nullptr || size == block->m_Capacity)
+        {
+            Block* grown = Block::Create(std::max(MIN_CAPACITY, 2 * size));
+            if (size > 0) std::copy_n(block->Items(), size, grown->Items());
+            grown->m_Size.store(size, std::memory_order_relaxed);
+            Publish(grown);
+            block = grown;
+        }
+
+        block->Items()[size] = value;
+        block->m_Size.store(size + 1, std::memory_order_release);
+    }
+
+    void Remove(const T& value)
+    {
+        const View view = GetView();
+        if (std::ranges::find(view, value) == view.end()) return;
+
+        Block* block = Block::Create(std::max(MIN_CAPACITY, view.size() - 1));
+        const auto last = std::ranges::remove_copy(view, block->Items(), value).out;
+        block->m_Size.store(static_cast<size_t>(last - block->Items()), std::memory_order_relaxed);
+        Publish(block);
+    }
+
+    void Clear()
+    {
+        Publish(nullptr);
+    }
+
+    template <typename Compare, typename Projection>
+    void Sort(Compare compare, Projection projection)
+    {
+        // The keys are taken once up front since they may be changed by other
+        // threads while sorting, which would leave the order inconsistent
+        const View view = GetView();
+        if (view.empty()) return;
+
+        std::vector<std::pair<std::invoke_result_t<Projection, const T&>, T>> keyed;
+        keyed.reserve(view.size());
+        for (const T& value : view) keyed.emplace_back(projection(value), value);
+        std::sort(keyed.begin(), keyed.end(), [&compare](const auto& a, const auto& b)
+        {
+            return compare(a.first, b.first);
+        });
+
+        // Sorted into an exactly sized block as no more children are expected
+        Block* block = Block::Create(view.size());
+        std::ranges::transform(keyed, block->Items(), [](const auto& entry) { return entry.second; });
+        block->m_Size.store(view.size(), std::memory_order_relaxed);
+        Publish(block);
+    }
+};
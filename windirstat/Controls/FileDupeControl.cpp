@@ -26,11 +26,11 @@
 #include "MainFrame.h"
 #include "FileDupeView.h"
 #include "Localization.h"
+#include "SubtreeVisitor.h"
 
 #include <execution>
 #include <unordered_map>
 #include <ranges>
-#include <stack>
 
 CFileDupeControl::CFileDupeControl() : CTreeListControl(20, COptions::DupeViewColumnOrder.Ptr(), COptions::DupeViewColumnWidths.Ptr())
 {
@@ -90,10 +90,10 @@ void CFileDupeControl::ProcessDuplicate(CItem * item, BlockingQueue<CItem*>* que
             auto hash = itemToHash->GetFileHash(hashType == ITF_PARTHASH ? partialBufferSize : 0, queue);
             lock.lock();
 
-            // Skip if not hashable
+            // Skip if not hashable; a cancelled scan leaves the file to the next one
             if (hash.empty())
             {
-                itemToHash->SetType(itemToHash->GetRawType() | ITF_SKIPHASH);
+                if (!queue->IsCancelled()) itemToHash->SetType(itemToHash->GetRawType() | ITF_SKIPHASH);
                 return;
             }
 
@@ -171,22 +171,25 @@ void CFileDupeControl::RemoveItem(CItem* item)
     // Exit immediately if not doing duplicate detector
     if (m_HashTracker.empty() && m_SizeTracker.empty()) return;
 
-    std::stack<CItem*> queue({ item });
-    while (!queue.empty())
+    SubtreeVisitor<CItem>::Visit<std::vector<CItem*>>(item, [](std::vector<CItem*>& files, CItem* qitem)
     {
-        const auto& qitem = queue.top();
-        queue.pop();
-        if (qitem->IsType(IT_FILE))
-        {
-            // Mark as all files as not being hashed anymore
-            std::erase(m_SizeTracker.at(qitem->GetSizeLogical()), qitem);
-            qitem->SetType(ITF_PARTHASH | ITF_FULLHASH, false);
-        }
-        else for (const auto& child : qitem->GetChildren())
+        if (!qitem->IsType(IT_FILE)) return true;
+
+        // Mark as all files as not being hashed anymore
+        qitem->SetType(ITF_PARTHASH | ITF_FULLHASH, false);
+        files.push_back(qitem);
+        return false;
+    },
+    [this](const std::vector<CItem*>& files)
+    {
+        for (const auto& file : files)
         {
-            queue.push(child);
+            if (const auto sizeSet = m_SizeTracker.find(file->GetSizeLogical()); sizeSet != m_SizeTracker.end())
+            {
+                std::erase(sizeSet->second, file);
+            }
         }
-    }
+    });
 
     // Remove all unhashed files from hash tracker
     for (auto& hashSet : m_HashTracker | std::views::values)
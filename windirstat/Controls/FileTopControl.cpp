@@ -25,9 +25,9 @@
 #include "MainFrame.h"
 #include "FileTopControl.h"
 #include "Localization.h"
+#include "SubtreeVisitor.h"
 
 #include <ranges>
-#include <stack>
 
 CFileTopControl::CFileTopControl() : CTreeListControl(20, COptions::TopViewColumnOrder.Ptr(), COptions::TopViewColumnWidths.Ptr())
 {
@@ -105,20 +105,19 @@ void CFileTopControl::SortItems()
 
 void CFileTopControl::RemoveItem(CItem* item)
 {
-    std::stack<CItem*> queue({ item });
-    while (!queue.empty())
+    SubtreeVisitor<CItem>::Visit<std::vector<CItem*>>(item, [](std::vector<CItem*>& files, CItem* qitem)
     {
-        const auto& qitem = queue.top();
-        queue.pop();
-        if (qitem->IsType(IT_FILE))
-        {
-            m_SizeMap.erase(qitem);
-        }
-        else for (const auto& child : qitem->GetChildren())
+        if (!qitem->IsType(IT_FILE)) return true;
+        files.push_back(qitem);
+        return false;
+    },
+    [this](const std::vector<CItem*>& files)
+    {
+        for (const auto& file : files)
         {
-            queue.push(child);
+            m_SizeMap.erase(file);
         }
-    }
+    });
 
     // Use the sort function to remove visual items
     CMainFrame::Get()->InvokeInMessageThread([&]
@@ -24,10 +24,10 @@
 #include "Localization.h"
 #include "CsvLoader.h"
 #include "Constants.h"
+#include "SubtreeVisitor.h"
 
 #include <fstream>
 #include <string>
-#include <stack>
 #include <unordered_map>
 #include <format>
 #include <array>
@@ -248,19 +248,15 @@ bool SaveResults(const std::wstring& path, CItem * item)
         outf << QuoteAndConvert(cols[i]) << ((i < cols.size() - 1) ? "," : "");
     }
 
-    // Output all items to file
+    // Output all items to file; lines are formatted in parallel and parents
+    // are always written before their children as required by the loader
     outf << "\r\n";
-    std::stack<CItem*> queue({ item });
-    while (!queue.empty())
+    SubtreeVisitor<CItem>::Visit<std::string>(item, [](std::string& lines, const CItem* qitem)
     {
-        // Grab item from queue
-        const CItem* qitem = queue.top();
-        queue.pop();
-
         // Output primary columns
         const bool nonPathItem = qitem->IsType(IT_MYCOMPUTER | IT_UNKNOWN | IT_FREESPACE);
-        outf << std::format("{},{},{},{},{},0x{:08X},{},0x{:04X}",
-            QuoteAndConvert(nonPathItem ? qitem->GetName() : qitem->GetPath()),
+        std::format_to(std::back_inserter(lines), "{},{},{},{},{},0x{:08X},{},0x{:04X}",
+            QuoteAndConvert(nonPathItem ? std::wstring(qitem->GetName()) : qitem->GetPath()),
             qitem->GetFilesCount(),
             qitem->GetFoldersCount(),
             qitem->GetSizeLogical(),
@@ -272,19 +268,19 @@ bool SaveResults(const std::wstring& path, CItem * item)
         // Output additional columns
         if (COptions::ShowColumnOwner)
         {
-            outf << "," << QuoteAndConvert(qitem->GetOwner(true));
+            lines += "," + QuoteAndConvert(qitem->GetOwner(true));
         }
 
         // Finalize lines
-        outf << "\r\n";
+        lines += "\r\n";
 
         // Descend into childitems
-        if (qitem->IsType(IT_FILE)) continue;
-        for (const auto& child : qitem->GetChildren())
-        {
-            queue.push(child);
-        }
-    }
+        return !qitem->IsType(IT_FILE);
+    },
+    [&outf](const std::string& lines)
+    {
+        outf << lines;
+    });
 
     outf.close();
     return true;
@@ -32,6 +32,7 @@
 #include "WinDirStat.h"
 #include "SmartPointer.h"
 #include "FileTopControl.h"
+#include "ScanCache.h"
 
 #include <functional>
 #include <unordered_map>
@@ -173,6 +174,7 @@ void CDirStatDoc::DeleteContents()
 
     // Wait for system to fully shutdown
     StopScanningEngine();
+    m_ChangeWatcher.Stop();
 
     // Clean out icon queue
     GetIconHandler()->ClearAsyncShellInfoQueue();
@@ -188,6 +190,8 @@ void CDirStatDoc::DeleteContents()
     m_RootItemTop = nullptr;
     m_RootItem = nullptr;
     m_ZoomItem = nullptr;
+    CItem::ClearFileIds();
+    CItem::ReleaseAllocations();
     CDirStatApp::Get()->ReReadMountPoints();
 }
 
@@ -678,6 +682,248 @@ void CDirStatDoc::RefreshItem(const std::vector<CItem*>& item) const
     GetDocument()->StartScanningEngine(item);
 }
 
+// Collects the folders the user is looking at so that the scanning queues
+// can process their subtrees first: folders expanded or selected in the file
+// tree and the folder the treemap is zoomed into.
+//
+void CDirStatDoc::UpdateScanFocus()
+{
+    std::unordered_set<const CItem*> focus;
+    const auto tree = CFileTreeControl::Get();
+    for (int i = 0; i < tree->GetItemCount(); i++)
+    {
+        const auto item = reinterpret_cast<const CItem*>(tree->GetItem(i));
+        if (item->IsExpanded() && !item->IsRootItem() && !item->IsType(IT_MYCOMPUTER | IT_DRIVE)) focus.insert(item);
+    }
+    for (const auto& item : tree->GetAllSelected<CItem>())
+    {
+        if (!item->IsType(IT_FILE)) focus.insert(item);
+    }
+    if (IsZoomed()) focus.insert(GetZoomItem());
+
+    // Report how long folders took to complete once they were focused
+    const ULONGLONG now = GetTickCount64();
+    std::erase_if(m_FocusStarted, [&focus, now](const auto& entry)
+    {
+        if (!focus.contains(entry.first)) return true;
+        if (!entry.first->IsDone()) return false;
+        VTRACE(L"Focused subtree completed in {} ms: {}", now - entry.second, entry.first->GetPath());
+        return true;
+    });
+    for (const auto& item : focus)
+    {
+        if (!item->IsDone()) m_FocusStarted.try_emplace(item, now);
+    }
+
+    // Completed folders have nothing left to prioritize
+    std::erase_if(focus, [](const auto& item) { return item->IsDone(); });
+    {
+        std::unique_lock lock(m_FocusMutex);
+        if (focus == m_FocusItems) return;
+        m_FocusItems = std::move(focus);
+        m_HasFocus = !m_FocusItems.empty();
+    }
+
+    // Move already queued folders in or out of the priority lane; the
+    // queues are only touched once the scan has set up and started them
+    std::lock_guard lock(m_FocusQueuesMutex);
+    if (!m_FocusQueuesReady) return;
+    for (auto& queue : m_queues | std::views::values)
+    {
+        queue.Reprioritize();
+    }
+}
+
+bool CDirStatDoc::IsScanFocused(const CItem* item)
+{
+    // Called on every push so avoid the lock while nothing is focused
+    if (!m_HasFocus) return false;
+
+    std::shared_lock lock(m_FocusMutex);
+    if (m_FocusItems.empty()) return false;
+    for (auto p = item; p != nullptr; p = p->GetParent())
+    {
+        if (m_FocusItems.contains(p)) return true;
+    }
+    return false;
+}
+
+// Distributes the global thread budget between the volumes being scanned.
+// Volumes with a high latency per folder get more workers as these spend
+// most of their time waiting; volumes are never given more workers than
+// they have folders to work on or than their device type can make use of.
+//
+void CDirStatDoc::BalanceScanThreads()
+{
+    std::lock_guard lock(m_ScheduleMutex);
+
+    std::unordered_map<std::wstring, unsigned int> wanted;
+    unsigned int total = 0;
+    for (auto& [volume, schedule] : m_Schedules)
+    {
+        auto& queue = m_queues.at(volume);
+        if (const auto [busy, completed] = queue.TakeLatencySample(); completed > 0)
+        {
+            const double latency = static_cast<double>(busy) / 1000.0 / static_cast<double>(completed);
+            schedule.m_Latency = schedule.m_Latency == 0.0 ? latency : (3.0 * schedule.m_Latency + latency) / 4.0;
+        }
+
+        const double scale = max(1.0, schedule.m_Latency / LOCAL_LATENCY);
+        auto workers = static_cast<unsigned int>(min(static_cast<double>(schedule.m_Limit), COptions::ScanningThreads.Obj() * scale));
+        if (schedule.m_Latency > 0.0)
+        {
+            workers = static_cast<unsigned int>(min<size_t>(workers, queue.GetQueuedCount() + queue.GetActiveCount()));
+        }
+        wanted[volume] = max(workers, 1u);
+        total += wanted[volume];
+    }
+
+    // Scale all volumes down in proportion if they want more than the budget;
+    // the seats left over by rounding down go to the largest remainders so
+    // the shares add up to the budget exactly even with more volumes than it
+    std::vector<std::pair<unsigned int, VOLUMESCHEDULE*>> remainders;
+    unsigned int assigned = 0;
+    for (auto& [volume, schedule] : m_Schedules)
+    {
+        if (total <= m_VolumeBudget)
+        {
+            schedule.m_Concurrency = wanted[volume];
+            continue;
+        }
+
+        const unsigned int exact = wanted[volume] * m_VolumeBudget;
+        schedule.m_Concurrency = exact / total;
+        assigned += schedule.m_Concurrency;
+        remainders.emplace_back(exact % total, &schedule);
+    }
+    std::ranges::stable_sort(remainders, std::greater<>(), &std::pair<unsigned int, VOLUMESCHEDULE*>::first);
+    for (const auto& schedule : remainders | std::views::take(m_VolumeBudget - assigned) | std::views::values)
+    {
+        schedule->m_Concurrency++;
+    }
+
+    for (auto& [volume, schedule] : m_Schedules)
+    {
+        m_queues.at(volume).SetConcurrency(schedule.m_Concurrency);
+    }
+}
+
+std::wstring CDirStatDoc::GetScanThreadsText()
+{
+    std::lock_guard lock(m_ScheduleMutex);
+    std::wstring volumes;
+    for (const auto& [volume, schedule] : m_Schedules)
+    {
+        std::wstring name = volume;
+        if (name.starts_with(L"\\\\?\\UNC\\")) name = L"\\\\" + name.substr(8);
+        else if (name.starts_with(L"\\\\?\\")) name = name.substr(4);
+        if (!volumes.empty()) volumes += L", ";
+        volumes += std::format(L"{} {}", name, schedule.m_Concurrency);
+    }
+    return volumes.empty() ? volumes : Localization::Format(IDS_SCANNING_THREADSs, volumes);
+}
+
+// Applies the folder and hashing limits from the options.  A running scan
+// is suspended meanwhile so no worker keeps waiting on the previous limits.
+//
+void CDirStatDoc::ApplyScanLimits()
+{
+    const bool running = HasRootItem() && !IsRootDone() && !CMainFrame::Get()->IsScanSuspended();
+    if (running)
+    {
+        for (auto& queue : m_queues | std::views::values)
+            ProcessMessagesUntilSignaled([&queue] { queue.SuspendExecution(); });
+    }
+
+    CItem::SetScanLimits(COptions::ScanningFolderLimit, COptions::ScanningHashLimit * 1024.0 * 1024.0);
+
+    if (running)
+    {
+        for (auto& queue : m_queues | std::views::values)
+            queue.ResumeExecution();
+    }
+}
+
+// Stops collecting changes once watching has been switched off; nothing is
+// done while a scan runs since the scan thread may be starting the watcher.
+//
+void CDirStatDoc::StopWatchingChanges()
+{
+    if (!m_ChangeWatcher.IsWatching() || IsScanRunning()) return;
+    m_ChangeWatcher.Stop();
+}
+
+// Applies the changes collected by the change watcher once they have settled.
+// Entries are added or removed in place; modified files, new directories and
+// folders for which changes were lost are rescanned.
+//
+void CDirStatDoc::ApplyWatchedChanges()
+{
+    if (!IsRootDone() || IsScanRunning()) return;
+
+    std::vector<std::wstring> changed;
+    std::vector<std::wstring> overflowed;
+    if (!m_ChangeWatcher.TakeChanges(changed, overflowed)) return;
+
+    // An overflow drops the changes without saying where they were made and
+    // directory write times do not reflect files changed in place, so the
+    // whole watched folder has to be rescanned to pick them up
+    std::vector<CItem*> rescan;
+    for (const auto& folder : overflowed)
+    {
+        if (CItem* item = m_RootItem->FindItemByPath(folder); item != nullptr) rescan.push_back(item);
+    }
+
+    // Handle parents before their children so changes within a folder that
+    // has just been added are left to the scan of that folder
+    std::ranges::sort(changed, [](const std::wstring& a, const std::wstring& b) { return a.size() < b.size(); });
+    std::unordered_set<CItem*> touched;
+    for (const auto& path : changed)
+    {
+        const size_t split = path.find_last_of(wds::chrBackslash);
+        if (split == std::wstring::npos) continue;
+        std::wstring folder = path.substr(0, split);
+        if (folder.back() == L':') folder += wds::chrBackslash;
+
+        CItem* parent = m_RootItem->FindItemByPath(folder);
+        if (parent == nullptr || parent->IsType(IT_FILE) || !parent->IsDone() ||
+            std::ranges::any_of(rescan, [parent](const CItem* item) { return item->IsAncestorOf(parent); }))
+        {
+            continue;
+        }
+
+        if (CItem* added = parent->ApplyChange(path.substr(split + 1)); added != nullptr)
+        {
+            rescan.push_back(added);
+        }
+        touched.insert(parent);
+    }
+
+    // Sizes changed up to the root so every ancestor of a changed entry is
+    // sorted again as the treemap requires children to be biggest first
+    std::unordered_set<CItem*> sorted;
+    for (const auto& parent : touched)
+    {
+        for (auto p = parent; p != nullptr && sorted.insert(p).second; p = p->GetParent())
+        {
+            p->SortItemsBySizePhysical();
+        }
+    }
+
+    // Extensions first seen here take the color of the least common ones
+    // rather than recoloring all extensions while the user is looking;
+    // rescans rebuild the extension data once they complete
+    std::vector<COLORREF> colors;
+    CTreeMap::GetDefaultPalette(colors);
+    for (auto& record : m_ExtensionData | std::views::values)
+    {
+        if (record.color == 0) record.color = colors.back();
+    }
+
+    if (!rescan.empty()) RefreshItem(rescan);
+    else UpdateAllViews(nullptr);
+}
+
 // UDC confirmation Dialog.
 //
 void CDirStatDoc::AskForConfirmation(USERDEFINEDCLEANUP* udc, const CItem* item)
@@ -773,7 +1019,7 @@ void CDirStatDoc::RecursiveUserDefinedCleanup(USERDEFINEDCLEANUP* udc, const std
         {
             continue;
         }
-        if (!CDirStatApp::Get()->IsFollowingAllowed(finder.GetFilePathLong(), finder.GetAttributes()))
+        if (!CDirStatApp::Get()->IsFollowingAllowed(finder.GetFilePathLong(), finder.GetAttributes(), finder.GetReparseTag()))
         {
             continue;
         }
@@ -1316,7 +1562,7 @@ void CDirStatDoc::OnCleanupEmptyFolder()
             select->GetPath()).c_str(), MB_YESNO) == IDYES)
         {
             // delete all children
-            DeletePhysicalItems(select->GetChildren(), false, true);
+            DeletePhysicalItems(select->GetChildren().ToVector(), false, true);
         }
     }
 
@@ -1333,7 +1579,7 @@ void CDirStatDoc::OnDisableHibernateFile()
     {
         for (const auto& child : drive->GetChildren())
         {
-            if (_wcsicmp(child->GetName().c_str(), L"hiberfil.sys") == 0)
+            if (_wcsicmp(std::wstring(child->GetName()).c_str(), L"hiberfil.sys") == 0)
             {
                 StartScanningEngine({ child });
             }
@@ -1472,6 +1718,8 @@ void CDirStatDoc::OnScanSuspend()
     // Wait for system to fully shutdown
     for (auto& queue : m_queues | std::views::values)
         ProcessMessagesUntilSignaled([&queue] { queue.SuspendExecution(); });
+    ProcessMessagesUntilSignaled([this] { m_SizeQueue.SuspendExecution(); });
+    ProcessMessagesUntilSignaled([this] { m_ExtentQueue.SuspendExecution(); });
 
     // Mark as suspended
     if (CMainFrame::Get() != nullptr)
@@ -1482,6 +1730,8 @@ void CDirStatDoc::OnScanResume()
 {
     for (auto& queue : m_queues | std::views::values)
         queue.ResumeExecution();
+    m_SizeQueue.ResumeExecution();
+    m_ExtentQueue.ResumeExecution();
 
     if (CMainFrame::Get() != nullptr)
         CMainFrame::Get()->SuspendState(false);
@@ -1492,10 +1742,19 @@ void CDirStatDoc::OnScanStop()
     // Request for all threads to stop processing
     for (auto& queue : m_queues | std::views::values)
         ProcessMessagesUntilSignaled([&queue] { queue.SuspendExecution(); });
+    ProcessMessagesUntilSignaled([this] { m_SizeQueue.SuspendExecution(); });
+    ProcessMessagesUntilSignaled([this] { m_ExtentQueue.SuspendExecution(); });
 
-    // Stop m_queues from executing
+    // Stop m_queues from executing; they steal from each other so are cancelled together
+    std::vector<BlockingQueue<CItem*>*> queues;
     for (auto& queue : m_queues | std::views::values)
-        ProcessMessagesUntilSignaled([&queue] { queue.CancelExecution(); });
+        queues.push_back(&queue);
+    ProcessMessagesUntilSignaled([&queues] { BlockingQueue<CItem*>::CancelExecution(queues); });
+    ProcessMessagesUntilSignaled([this] { m_SizeQueue.CancelExecution(); });
+    ProcessMessagesUntilSignaled([this] { m_ExtentQueue.CancelExecution(); });
+
+    // Scanning threads are gone so forget what they were working on
+    CItem::ClearActiveItems();
 
     // Wait for wrapper thread to complete
     if (m_thread != nullptr)
@@ -1580,11 +1839,26 @@ void CDirStatDoc::StartScanningEngine(std::vector<CItem*> items)
         static std::shared_mutex mutex;
         std::lock_guard lock(mutex);
 
+        // Hard links are only matched within a single scan
+        CItem::ClearFileIds();
+
+        // Collect changes made while and after scanning to apply them afterwards
+        if (COptions::WatchForChanges && !m_ChangeWatcher.IsWatching())
+        {
+            std::vector<std::wstring> folders;
+            if (GetRootItem()->IsType(IT_MYCOMPUTER))
+            {
+                for (const auto& drive : GetRootItem()->GetChildren()) folders.push_back(drive->GetPath());
+            }
+            else folders.push_back(GetRootItem()->GetPath());
+            m_ChangeWatcher.Start(folders);
+        }
+
         // If scanning drive(s) just rescan the child nodes
         if (items.size() == 1 && items.at(0)->IsType(IT_MYCOMPUTER))
         {
             items.at(0)->ResetScanStartTime();
-            items = items.at(0)->GetChildren();
+            items = items.at(0)->GetChildren().ToVector();
         }
 
         const auto selectedItems = GetAllSelected();
@@ -1611,6 +1885,7 @@ void CDirStatDoc::StartScanningEngine(std::vector<CItem*> items)
             item->UpwardRecalcLastChange(true);
             item->UpwardSubtractSizePhysical(item->GetSizePhysical());
             item->UpwardSubtractSizeLogical(item->GetSizeLogical());
+            item->UpwardSubtractSizeExclusive(item->GetSizeExclusive());
             item->UpwardSubtractFiles(item->GetFilesCount());
             item->UpwardSubtractFolders(item->GetFoldersCount());
             item->RemoveAllChildren();
@@ -1623,7 +1898,7 @@ void CDirStatDoc::StartScanningEngine(std::vector<CItem*> items)
             // Handle if item to be refreshed has been removed
             if (item->IsType(IT_FILE | IT_DIRECTORY | IT_DRIVE) &&
                 !FileFindEnhanced::DoesFileExist(item->GetFolderPath(),
-                    item->IsType(IT_FILE) ? item->GetName() : std::wstring()))
+                    item->IsType(IT_FILE) ? std::wstring(item->GetName()) : std::wstring()))
             {
                 // Remove item from list so we do not rescan it
                 std::erase(items, item);
@@ -1658,7 +1933,7 @@ void CDirStatDoc::StartScanningEngine(std::vector<CItem*> items)
                 continue;
             }
 
-            item->UpwardAddReadJobs(1);
+            item->UpwardAddPendingJob();
             item->UpwardSetUndone();
 
             // Create status progress bar
@@ -1676,14 +1951,66 @@ void CDirStatDoc::StartScanningEngine(std::vector<CItem*> items)
             else ASSERT(FALSE);
         }
 
-        // Create subordinate threads if there is work to do
+        // Allow idle workers of a completed volume to help out the others
+        std::vector<BlockingQueue<CItem*>*> stealGroup;
+        for (auto& queue : m_queues | std::views::values)
+            stealGroup.push_back(&queue);
         for (auto& queue : m_queues | std::views::values)
+            queue.SetStealGroup(stealGroup);
+
+        // Folders the user is looking at are scanned ahead of the others
+        for (auto& queue : m_queues | std::views::values)
+            queue.SetPriority([this](CItem* const& item) { return IsScanFocused(item); });
+
+        // Load the listings of the volumes up front rather than in the first
+        // scanning thread that needs them
+        if (COptions::ScanningCache)
+        {
+            for (const auto& volume : m_queues | std::views::keys) ScanCache::Get().Prepare(volume);
+        }
+
+        // Limits may have been changed since the last scan
+        CItem::SetScanLimits(COptions::ScanningFolderLimit, COptions::ScanningHashLimit * 1024.0 * 1024.0);
+
+        // Start as many workers per volume as its device type can make use of
+        // but no more than the budget left by the sizing pools which run
+        // alongside; how many of them take folders is adjusted while scanning
+        {
+            std::lock_guard scheduleLock(m_ScheduleMutex);
+            const int pools = COptions::ScanningThreads.Obj() + (COptions::ProcessSharedExtents ? 1 : 0);
+            m_VolumeBudget = static_cast<unsigned int>(max(COptions::ScanningThreadsTotal.Obj() - pools, 1));
+            m_Schedules.clear();
+            for (const auto& volume : m_queues | std::views::keys)
+            {
+                m_Schedules[volume].m_Limit = min(m_VolumeBudget, static_cast<unsigned int>(IsRemoteVolume(volume) ?
+                    COptions::ScanningThreadsTotal.Obj() : HasSeekPenalty(volume) ? SEEK_BOUND_WORKERS : COptions::ScanningThreads.Obj()));
+            }
+        }
+        BalanceScanThreads();
+
+        // Create subordinate threads if there is work to do
+        const auto scanStart = GetTickCount64();
+        // Shared clusters are attributed in discovery order by a single thread
+        const auto extentQueue = COptions::ProcessSharedExtents ? &m_ExtentQueue : nullptr;
+        m_SizeQueue.StartThreads(COptions::ScanningThreads, [this, extentQueue]()
+        {
+            CItem::ScanItemsPhysicalSize(&m_SizeQueue, extentQueue);
+        });
+        if (extentQueue != nullptr) m_ExtentQueue.StartThreads(1, [this]()
+        {
+            CItem::ScanItemsExtents(&m_ExtentQueue);
+        });
+        for (auto& [volume, queue] : m_queues)
         {
-            queue.StartThreads(COptions::ScanningThreads, [&queue]()
+            queue.StartThreads(m_Schedules.at(volume).m_Limit, [&queue, extentQueue, this]()
             {
-                CItem::ScanItems(&queue);
+                CItem::ScanItems(&queue, &m_SizeQueue, extentQueue);
             });
         }
+        {
+            std::lock_guard focusLock(m_FocusQueuesMutex);
+            m_FocusQueuesReady = true;
+        }
 
         // Ensure toolbar buttons reflect scanning status
         CMainFrame::Get()->InvokeInMessageThread([&]
@@ -1695,6 +2022,30 @@ void CDirStatDoc::StartScanningEngine(std::vector<CItem*> items)
         // Wait for all threads to run out of work
         for (auto& queue : m_queues | std::views::values)
             queue.WaitForCompletion();
+        const bool completed = std::ranges::none_of(m_queues | std::views::values,
+            [](const BlockingQueue<CItem*>& queue) { return queue.IsCancelled(); });
+        VTRACE(L"Scan completed in {} ms", GetTickCount64() - scanStart);
+        {
+            std::lock_guard focusLock(m_FocusQueuesMutex);
+            m_FocusQueuesReady = false;
+        }
+        {
+            std::lock_guard scheduleLock(m_ScheduleMutex);
+            m_Schedules.clear();
+        }
+
+        // Remaining physical sizes are needed before sorting
+        m_SizeQueue.WaitForCompletion();
+        CItem::ScanItemsResort();
+        VTRACE(L"Physical sizes resolved in {} ms", GetTickCount64() - scanStart);
+        m_ExtentQueue.WaitForCompletion();
+        VTRACE(L"Shared extents resolved in {} ms", GetTickCount64() - scanStart);
+#ifdef _DEBUG
+        ULONGLONG itemReserved, itemLive;
+        CItem::GetAllocatorUsage(itemReserved, itemLive);
+        VTRACE(L"Item memory: {} bytes for {} items ({} bytes per item, sizeof(CItem) = {})", itemLive,
+            m_RootItem->GetItemsCount(), itemLive / max(m_RootItem->GetItemsCount(), 1ull), sizeof(CItem));
+#endif
    
         // Restore unknown and freespace items
         for (const auto& item : items)
@@ -1736,5 +2087,17 @@ void CDirStatDoc::StartScanningEngine(std::vector<CItem*> items)
                 if (visualInfo[item].isSelected) GetFocusControl()->SelectItem(item, false, true);
             }
         });
+
+        // Keep the directory listings recorded by this scan for the next one;
+        // listings are only aged by complete scans of whole roots
+        if (COptions::ScanningCache)
+        {
+            std::vector<std::wstring> roots;
+            for (const auto& item : items)
+            {
+                if (completed && item->IsType(ITF_ROOTITEM | IT_DRIVE)) roots.push_back(item->GetPath());
+            }
+            ScanCache::Get().Save(roots);
+        }
     });
 }
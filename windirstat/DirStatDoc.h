@@ -24,8 +24,11 @@
 #include "BlockingQueue.h"
 #include "Options.h"
 #include "GlobalHelpers.h"
+#include "ChangeWatcher.h"
 
+#include <shared_mutex>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 class CItem;
@@ -125,6 +128,13 @@ protected:
     void StopScanningEngine();
     void RefreshItem(const std::vector<CItem*>& item) const;
     void RefreshItem(CItem* item) const { RefreshItem(std::vector{ item }); }
+    void ApplyWatchedChanges();
+    void StopWatchingChanges();
+    void UpdateScanFocus();
+    bool IsScanFocused(const CItem* item);
+    void BalanceScanThreads();
+    void ApplyScanLimits();
+    std::wstring GetScanThreadsText();
 
     static void OpenItem(const CItem* item, const std::wstring& verb = {});
 
@@ -170,7 +180,30 @@ protected:
     CList<CItem*, CItem*> m_ReselectChildStack; // Stack for the "Re-select Child"-Feature
 
     std::unordered_map<std::wstring, BlockingQueue<CItem*>> m_queues; // The scanning and thread queue
+    BlockingQueue<CItem*> m_SizeQueue; // Files whose physical size is resolved in the background
+    BlockingQueue<CItem*> m_ExtentQueue; // Files whose clusters are mapped to find shared extents
     std::thread* m_thread = nullptr; // Wrapper thread so we do not occupy the UI thread
+    ChangeWatcher m_ChangeWatcher; // Collects changes made to the scanned folders after scanning
+
+    std::shared_mutex m_FocusMutex;
+    std::unordered_set<const CItem*> m_FocusItems; // Folders whose subtrees are scanned ahead of the others
+    std::atomic<bool> m_HasFocus = false; // Whether m_FocusItems is not empty; checked on every push
+    std::mutex m_FocusQueuesMutex;
+    bool m_FocusQueuesReady = false; // Whether m_queues are set up and started so focus can be applied
+    std::unordered_map<const CItem*, ULONGLONG> m_FocusStarted; // Time focused folders were first seen pending
+
+    // Workers used for a volume, adjusted while scanning by the latency of its directories
+    using VOLUMESCHEDULE = struct VOLUMESCHEDULE
+    {
+        unsigned int m_Limit = 1;       // Workers started; the most the volume can make use of
+        unsigned int m_Concurrency = 1; // Workers currently allowed to take folders
+        double m_Latency = 0.0;         // Milliseconds spent per folder, smoothed
+    };
+    static constexpr unsigned int SEEK_BOUND_WORKERS = 2; // More workers only make rotating disks seek more
+    static constexpr double LOCAL_LATENCY = 1.0;          // Milliseconds per folder expected from a local disk
+    std::mutex m_ScheduleMutex;
+    std::unordered_map<std::wstring, VOLUMESCHEDULE> m_Schedules;
+    unsigned int m_VolumeBudget = 1; // Workers shared by all volumes once the sizing pools are accounted for
 
     DECLARE_MESSAGE_MAP()
     afx_msg void OnRefreshSelected();
@@ -22,113 +22,76 @@
 
 #include "FileFind.h"
 #include "Options.h"
-#include "Tracer.h"
-
-#pragma comment(lib,"ntdll.lib")
-
-NTSTATUS(WINAPI* NtQueryDirectoryFile)(HANDLE FileHandle, HANDLE Event, PVOID ApcRoutine,
-    PVOID ApcContext, PIO_STATUS_BLOCK IoStatusBlock, PVOID FileInformation,
-    ULONG Length, FILE_INFORMATION_CLASS FileInformationClass, BOOLEAN ReturnSingleEntry,
-    PUNICODE_STRING FileName, BOOLEAN RestartScan) = reinterpret_cast<decltype(NtQueryDirectoryFile)>(
-        static_cast<LPVOID>(GetProcAddress(LoadLibrary(L"ntdll.dll"), "NtQueryDirectoryFile")));
-
-FileFindEnhanced::~FileFindEnhanced()
-{
-    if (m_Handle != nullptr) NtClose(m_Handle);
-}
+#include "MountPoints.h"
 
 bool FileFindEnhanced::FindNextFile()
 {
-    bool success = false;
-    if (m_Firstrun || m_CurrentInfo->NextEntryOffset == 0)
-    {
-        constexpr auto BUFFER_SIZE = 64 * 1024;
-        thread_local std::vector<BYTE> m_DirectoryInfo(BUFFER_SIZE);
-
-        // handle optional pattern mask
-        UNICODE_STRING uSearch;
-        uSearch.Length = static_cast<USHORT>(m_Search.size() * sizeof(WCHAR));
-        uSearch.MaximumLength = static_cast<USHORT>(m_Search.size() + 1) * sizeof(WCHAR);
-        uSearch.Buffer = m_Search.data();
-
-        // enumerate files in the directory
-        constexpr auto FileFullDirectoryInformation = 2;
-        IO_STATUS_BLOCK IoStatusBlock;
-        const NTSTATUS Status = NtQueryDirectoryFile(m_Handle, nullptr, nullptr, nullptr, &IoStatusBlock,
-            m_DirectoryInfo.data(), BUFFER_SIZE, static_cast<FILE_INFORMATION_CLASS>(FileFullDirectoryInformation),
-            FALSE, (uSearch.Length > 0) ? &uSearch : nullptr, (m_Firstrun) ? TRUE : FALSE);
-
-        // fetch point to current node 
-        success = (Status == 0);
-        m_CurrentInfo = reinterpret_cast<FILE_FULL_DIR_INFORMATION*>(m_DirectoryInfo.data());
-    }
-    else
+    // fetch the next batch from the backend once the current one is consumed
+    if (m_Firstrun || ++m_RecordIndex >= m_Records.size())
     {
-        m_CurrentInfo = reinterpret_cast<FILE_FULL_DIR_INFORMATION*>(
-            &reinterpret_cast<BYTE*>(m_CurrentInfo)[m_CurrentInfo->NextEntryOffset]);
-        success = true;
+        m_RecordIndex = 0;
+        if (!m_Backend->ReadBatch(m_Records) || m_Records.empty())
+        {
+            m_Firstrun = false;
+            return false;
+        }
     }
 
-    if (success)
+    // the name refers to the backend buffer which stays valid until the
+    // next batch so it is not copied here
+    m_CurrentInfo = &m_Records[m_RecordIndex];
+    m_Name = m_CurrentInfo->Name;
+
+    // special case for reparse on initial run points since it will
+    // return the attributes on the destination folder and not the reparse
+    // point attributes itself that we want
+    if (m_Firstrun)
     {
-        // handle unexpected trailing null on some file systems
-        ULONG nameLength = m_CurrentInfo->FileNameLength / sizeof(WCHAR);
-        if (nameLength > 1 && m_CurrentInfo->FileName[nameLength - 1] == L'\0')
-            nameLength -= 1;
-
-        // copy name into local buffer
-        m_Name.resize(nameLength);
-        std::wmemcpy(m_Name.data(), m_CurrentInfo->FileName, nameLength);
-
-        // special case for reparse on initial run points since it will
-        // return the attributes on the destination folder and not the reparse
-        // point attributes itself that we want
-        if (m_Firstrun)
+        // Use cached value passed in from previous capture
+        m_CurrentInfo->Attributes = m_InitialAttributes;
+
+        // Fallback if cached value was not passed
+        if (m_CurrentInfo->Attributes == INVALID_FILE_ATTRIBUTES)
         {
-            // Use cached value passed in from previous capture
-            m_CurrentInfo->FileAttributes = m_InitialAttributes;
-
-            // Fallback if cached value was not passed
-            if (m_CurrentInfo->FileAttributes == INVALID_FILE_ATTRIBUTES)
-            {
-                std::wstring initialPath = GetFilePathLong();
-                if (IsDots()) initialPath.pop_back();
-                m_CurrentInfo->FileAttributes = GetFileAttributes(initialPath.c_str());
-            }
+            std::wstring initialPath = GetFilePathLong();
+            if (IsDots()) initialPath.pop_back();
+            m_CurrentInfo->Attributes = GetFileAttributes(initialPath.c_str());
         }
     }
 
     m_Firstrun = false;
-    return success;
+    return true;
 }
 
 bool FileFindEnhanced::FindFile(const std::wstring & strFolder, const std::wstring& strName, const DWORD attr)
 {
-    // stash the search pattern for later use
-    m_Search = strName;
     m_InitialAttributes = attr;
 
     // convert the path to a long path that is compatible with the other call
-    m_Base = strFolder;
-    if (m_Base.find(L":\\", 1) == 1) m_Base = m_Dos.data() + m_Base;
-    else if (m_Base.starts_with(L"\\\\")) m_Base = m_DosUNC.data() + m_Base.substr(2);
-    UNICODE_STRING path;
-    path.Length = static_cast<USHORT>(m_Base.size() * sizeof(WCHAR));
-    path.MaximumLength = static_cast<USHORT>(m_Base.size() + 1) * sizeof(WCHAR);
-    path.Buffer = m_Base.data();
-
-    // update object attributes object
-    OBJECT_ATTRIBUTES attributes;
-    InitializeObjectAttributes(&attributes, nullptr, OBJ_CASE_INSENSITIVE, nullptr, nullptr);
-    attributes.ObjectName = &path;
-
-    // get an open file handle
-    IO_STATUS_BLOCK statusBlock = {};
-    if (const NTSTATUS status = NtOpenFile(&m_Handle, FILE_LIST_DIRECTORY | SYNCHRONIZE,
-        &attributes, &statusBlock, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
-        FILE_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT | FILE_OPEN_FOR_BACKUP_INTENT); status != 0)
+    m_Base = MakeNativePath(strFolder);
+
+    // open the directory with the enumeration backend
+    m_Backend = FileFindBackend::Create();
+    if (!m_Backend->Open(m_Base, strName))
+    {
+        return FALSE;
+    }
+
+    // do initial search
+    return FindNextFile();
+}
+
+bool FileFindEnhanced::FindFile(const FileFindBackend::Handle& parent, const std::wstring& strFolderName,
+    const std::function<std::wstring()>& folderResolver, const DWORD attr)
+{
+    // open relative to the parent so the full path only has to
+    // be built if it is requested or the relative open fails
+    m_InitialAttributes = attr;
+    m_BaseResolver = folderResolver;
+    m_Backend = FileFindBackend::Create();
+    if (!m_Backend->Open(strFolderName, {}, parent, attr) &&
+        !m_Backend->Open(GetBase(), {}))
     {
-        VTRACE(L"File Access Error {:#08X}: {}", static_cast<DWORD>(status), m_Base.data());
         return FALSE;
     }
 
@@ -136,9 +99,35 @@ bool FileFindEnhanced::FindFile(const std::wstring & strFolder, const std::wstri
     return FindNextFile();
 }
 
+FileFindBackend::Handle FileFindEnhanced::GetHandle() const
+{
+    return m_Backend != nullptr ? m_Backend->GetHandle() : nullptr;
+}
+
+ULONG FileFindEnhanced::GetQueryCount() const
+{
+    return m_Backend != nullptr ? m_Backend->GetQueryCount() : 0;
+}
+
+const std::wstring& FileFindEnhanced::GetBase() const
+{
+    if (m_Base.empty() && m_BaseResolver != nullptr)
+    {
+        m_Base = MakeNativePath(m_BaseResolver());
+    }
+    return m_Base;
+}
+
+std::wstring FileFindEnhanced::MakeNativePath(const std::wstring& path)
+{
+    if (path.find(L":\\", 1) == 1) return m_Dos.data() + path;
+    if (path.starts_with(L"\\\\")) return m_DosUNC.data() + path.substr(2);
+    return path;
+}
+
 bool FileFindEnhanced::IsDirectory() const
 {
-    return (m_CurrentInfo->FileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+    return (m_CurrentInfo->Attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
 }
 
 bool FileFindEnhanced::IsDots() const
@@ -148,65 +137,92 @@ bool FileFindEnhanced::IsDots() const
 
 bool FileFindEnhanced::IsHidden() const
 {
-    return (m_CurrentInfo->FileAttributes & FILE_ATTRIBUTE_HIDDEN) != 0;
+    return (m_CurrentInfo->Attributes & FILE_ATTRIBUTE_HIDDEN) != 0;
 }
 
 bool FileFindEnhanced::IsHiddenSystem() const
 {
     constexpr DWORD hiddenSystem = FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM;
-    return (m_CurrentInfo->FileAttributes & hiddenSystem) == hiddenSystem;
+    return (m_CurrentInfo->Attributes & hiddenSystem) == hiddenSystem;
 }
 
 bool FileFindEnhanced::IsProtectedReparsePoint() const
 {
     constexpr DWORD protect = FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM | FILE_ATTRIBUTE_REPARSE_POINT;
-    return (m_CurrentInfo->FileAttributes & protect) == protect;
+    return (m_CurrentInfo->Attributes & protect) == protect;
 }
 
 DWORD FileFindEnhanced::GetAttributes() const
 {
-    return m_CurrentInfo->FileAttributes;
+    return m_CurrentInfo->Attributes;
 }
 
-std::wstring FileFindEnhanced::GetFileName() const
+std::wstring_view FileFindEnhanced::GetFileName() const
 {
     return m_Name;
 }
 
 ULONGLONG FileFindEnhanced::GetFileSizePhysical() const
 {
-    if (m_CurrentInfo->AllocationSize.QuadPart == 0 &&
-        m_CurrentInfo->EndOfFile.QuadPart != 0)
+    if (m_CurrentInfo->SizePhysical == 0 &&
+        m_CurrentInfo->SizeLogical != 0)
     {
         DWORD highPart;
         DWORD lowPart = GetCompressedFileSize(GetFilePathLong().c_str(), &highPart);
         if (lowPart != INVALID_FILE_SIZE || GetLastError() == NO_ERROR)
         {
-            m_CurrentInfo->AllocationSize.LowPart = lowPart;
-            m_CurrentInfo->AllocationSize.HighPart = static_cast<LONG>(highPart);
+            m_CurrentInfo->SizePhysical = static_cast<ULONGLONG>(highPart) << 32 | lowPart;
         }
     }
 
-    return m_CurrentInfo->AllocationSize.QuadPart;
+    return m_CurrentInfo->SizePhysical;
+}
+
+bool FileFindEnhanced::IsFileSizePhysicalKnown() const
+{
+    // entries without an allocation size have to be opened by path
+    // in order to determine their physical size
+    return m_CurrentInfo->SizePhysical != 0 || m_CurrentInfo->SizeLogical == 0;
 }
 
 ULONGLONG FileFindEnhanced::GetFileSizeLogical() const
 {
-    return m_CurrentInfo->EndOfFile.QuadPart;
+    return m_CurrentInfo->SizeLogical;
 }
 
 FILETIME FileFindEnhanced::GetLastWriteTime() const
 {
-    return { m_CurrentInfo->LastWriteTime.LowPart,
-        static_cast<DWORD>(m_CurrentInfo->LastWriteTime.HighPart) };
+    return m_CurrentInfo->LastWriteTime;
+}
+
+const FILE_ID_128& FileFindEnhanced::GetFileId() const
+{
+    return m_CurrentInfo->FileId;
+}
+
+ULONGLONG FileFindEnhanced::GetVolumeSerial() const
+{
+    return m_Backend->GetHandle()->m_Volume->m_Serial;
+}
+
+DWORD FileFindEnhanced::GetReparseTag() const
+{
+    // the tag is normally returned with the entry; only query the
+    // reparse point directly if the file system did not provide it
+    if (m_CurrentInfo->ReparseTag == 0 && CReparsePoints::IsReparsePoint(m_CurrentInfo->Attributes))
+    {
+        m_CurrentInfo->ReparseTag = CReparsePoints::GetReparseTag(GetFilePathLong());
+    }
+
+    return m_CurrentInfo->ReparseTag;
 }
 
 std::wstring FileFindEnhanced::GetFilePath() const
 {
     // Get full path to folder or file
-    std::wstring path = m_Base.back() == L'\\'
-        ? (m_Base + m_Name)
-        : (m_Base + L"\\" + m_Name);
+    std::wstring path = GetBase();
+    if (path.back() != L'\\') path += L'\\';
+    path += m_Name;
 
     // Strip special DOS chars
     if (path.starts_with(m_DosUNC)) return L"\\\\" + path.substr(m_DosUNC.size());
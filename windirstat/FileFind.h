@@ -21,54 +21,54 @@
 #pragma once
 
 #include "stdafx.h"
+#include "FileFindBackend.h"
+#include <functional>
 #include <string>
 
 class FileFindEnhanced final
 {
-    using FILE_FULL_DIR_INFORMATION = struct {
-        ULONG         NextEntryOffset;
-        ULONG         FileIndex;
-        LARGE_INTEGER CreationTime;
-        LARGE_INTEGER LastAccessTime;
-        LARGE_INTEGER LastWriteTime;
-        LARGE_INTEGER ChangeTime;
-        LARGE_INTEGER EndOfFile;
-        LARGE_INTEGER AllocationSize;
-        ULONG         FileAttributes;
-        ULONG         FileNameLength;
-        ULONG         EaSize;
-        WCHAR         FileName[1];
-    };
-
-    std::wstring m_Search;
-    std::wstring m_Base;
-    std::wstring m_Name;
-    HANDLE m_Handle = nullptr;
+    mutable std::wstring m_Base;
+    mutable std::function<std::wstring()> m_BaseResolver;
+    std::wstring_view m_Name;
+    std::unique_ptr<FileFindBackend> m_Backend;
+    std::vector<FileFindRecord> m_Records;
+    size_t m_RecordIndex = 0;
     DWORD m_InitialAttributes = INVALID_FILE_ATTRIBUTES;
     bool m_Firstrun = true;
-    FILE_FULL_DIR_INFORMATION* m_CurrentInfo = nullptr;
+    FileFindRecord* m_CurrentInfo = nullptr;
     static constexpr std::wstring_view m_Dos = L"\\??\\";
     static constexpr std::wstring_view m_DosUNC = L"\\??\\UNC\\";
     static constexpr std::wstring_view m_Long = L"\\\\?\\";
     static constexpr std::wstring_view m_LongUNC = L"\\\\?\\UNC\\";
 
+    const std::wstring& GetBase() const;
+    static std::wstring MakeNativePath(const std::wstring& path);
+
 public:
 
     FileFindEnhanced() = default;
-    ~FileFindEnhanced();
+    ~FileFindEnhanced() = default;
 
     bool FindNextFile();
     bool FindFile(const std::wstring& strFolder,const std::wstring& strName = L"", DWORD attr = INVALID_FILE_ATTRIBUTES);
+    bool FindFile(const FileFindBackend::Handle& parent, const std::wstring& strFolderName,
+        const std::function<std::wstring()>& folderResolver, DWORD attr = INVALID_FILE_ATTRIBUTES);
+    FileFindBackend::Handle GetHandle() const;
+    ULONG GetQueryCount() const;
     bool IsDirectory() const;
     bool IsDots() const;
     bool IsHidden() const;
     bool IsHiddenSystem() const;
     bool IsProtectedReparsePoint() const;
     DWORD GetAttributes() const;
-    std::wstring GetFileName() const;
+    std::wstring_view GetFileName() const;
     ULONGLONG GetFileSizePhysical() const;
+    bool IsFileSizePhysicalKnown() const;
     ULONGLONG GetFileSizeLogical() const;
     FILETIME GetLastWriteTime() const;
+    const FILE_ID_128& GetFileId() const;
+    ULONGLONG GetVolumeSerial() const;
+    DWORD GetReparseTag() const;
     std::wstring GetFilePath() const;
     std::wstring GetFilePathLong() const;
     static bool DoesFileExist(const std::wstring& folder, const std::wstring& file = {});
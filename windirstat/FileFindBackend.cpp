@@ -0,0 +1,342 @@
+﻿// FileFindBackend.cpp - Implementation of the directory enumeration backends
+//
+// WinDirStat - Directory Statistics
+// Copyright © WinDirStat Team
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#include "stdafx.h"
+
+#include "FileFindBackend.h"
+#include "Options.h"
+#include "ScanCache.h"
+#include "Tracer.h"
+
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+
+#pragma comment(lib,"ntdll.lib")
+
+NTSTATUS(WINAPI* NtQueryDirectoryFile)(HANDLE FileHandle, HANDLE Event, PVOID ApcRoutine,
+    PVOID ApcContext, PIO_STATUS_BLOCK IoStatusBlock, PVOID FileInformation,
+    ULONG Length, FILE_INFORMATION_CLASS FileInformationClass, BOOLEAN ReturnSingleEntry,
+    PUNICODE_STRING FileName, BOOLEAN RestartScan) = reinterpret_cast<decltype(NtQueryDirectoryFile)>(
+        static_cast<LPVOID>(GetProcAddress(LoadLibrary(L"ntdll.dll"), "NtQueryDirectoryFile")));
+
+std::unique_ptr<FileFindBackend> FileFindBackend::Create()
+{
+    auto backend = std::make_unique<FileFindBackendNt>(
+        static_cast<FileFindBackendNt::Mode>(COptions::ScanningBackendMode.Obj()));
+    if (!COptions::ScanningCache) return backend;
+    return std::make_unique<FileFindBackendCached>(std::move(backend));
+}
+
+FileFindBackendNt::FileFindBackendNt(const Mode mode)
+{
+    // the extended class also returns reparse tags and full file identifiers
+    // so that no metadata has to be queried per entry after enumeration
+    if (mode == Mode::Extended) m_InfoClass = FileIdExtdDirectoryInformation;
+}
+
+FileFindBackendNt::~FileFindBackendNt()
+{
+    if (!m_DirectoryInfo.empty() && m_SpareBuffers.size() < BUFFER_SPARES)
+    {
+        m_SpareBuffers.push_back(std::move(m_DirectoryInfo));
+    }
+}
+
+FileFindBackend::Directory::~Directory()
+{
+    if (m_Handle != nullptr) NtClose(m_Handle);
+}
+
+std::shared_ptr<FileFindBackend::Volume> FileFindBackendNt::LookupVolume(const HANDLE handle)
+{
+    // directories on the same volume share what was learned about it
+    static std::mutex volumesMutex;
+    static std::unordered_map<ULONGLONG, std::shared_ptr<Volume>> volumes;
+
+    FILE_ID_INFO idInfo;
+    BY_HANDLE_FILE_INFORMATION info;
+    ULONGLONG serial = 0;
+    if (GetFileInformationByHandleEx(handle, FileIdInfo, &idInfo, sizeof(idInfo)) != 0) serial = idInfo.VolumeSerialNumber;
+    else if (GetFileInformationByHandle(handle, &info) != 0) serial = info.dwVolumeSerialNumber;
+
+    // volumes without a serial number are not shared
+    if (serial == 0) return std::make_shared<Volume>();
+
+    std::lock_guard lock(volumesMutex);
+    auto& volume = volumes[serial];
+    if (volume == nullptr)
+    {
+        volume = std::make_shared<Volume>();
+        volume->m_Serial = serial;
+    }
+    return volume;
+}
+
+bool FileFindBackendNt::Open(const std::wstring& path, const std::wstring& pattern, const Handle& parent, const DWORD attributes)
+{
+    // stash the search pattern for later use
+    m_Search = pattern;
+
+    std::wstring base = path;
+    UNICODE_STRING unicodePath;
+    unicodePath.Length = static_cast<USHORT>(base.size() * sizeof(WCHAR));
+    unicodePath.MaximumLength = static_cast<USHORT>(base.size() + 1) * sizeof(WCHAR);
+    unicodePath.Buffer = base.data();
+
+    // update object attributes object
+    OBJECT_ATTRIBUTES objectAttributes;
+    InitializeObjectAttributes(&objectAttributes, nullptr, OBJ_CASE_INSENSITIVE,
+        parent != nullptr ? parent->m_Handle : nullptr, nullptr);
+    objectAttributes.ObjectName = &unicodePath;
+
+    // get an open file handle
+    HANDLE handle = nullptr;
+    IO_STATUS_BLOCK statusBlock = {};
+    if (const NTSTATUS status = NtOpenFile(&handle, FILE_LIST_DIRECTORY | FILE_READ_ATTRIBUTES | SYNCHRONIZE,
+        &objectAttributes, &statusBlock, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        FILE_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT | FILE_OPEN_FOR_BACKUP_INTENT); status != 0)
+    {
+        VTRACE(L"File Access Error {:#08X}: {}", static_cast<DWORD>(status), base.data());
+        return false;
+    }
+
+    m_Handle = std::make_shared<Directory>();
+    m_Handle->m_Handle = handle;
+
+    // only reparse points can lead to another volume so the volume is
+    // only looked up for those and for directories opened by path
+    m_Handle->m_Volume = parent != nullptr && attributes != INVALID_FILE_ATTRIBUTES &&
+        (attributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0 ? parent->m_Volume : LookupVolume(handle);
+
+    // skip information classes that already failed on this volume
+    m_InfoClass = std::min(m_InfoClass, m_Handle->m_Volume->m_InfoClass.load(std::memory_order_relaxed));
+    return true;
+}
+
+FileFindBackend::Handle FileFindBackendNt::GetHandle() const
+{
+    return m_Handle;
+}
+
+template <typename InfoType> void FileFindBackendNt::ParseBatch(const BYTE* buffer, std::vector<FileFindRecord>& records) const
+{
+    for (auto info = reinterpret_cast<const InfoType*>(buffer);;
+        info = reinterpret_cast<const InfoType*>(&reinterpret_cast<const BYTE*>(info)[info->NextEntryOffset]))
+    {
+        // handle unexpected trailing null on some file systems
+        ULONG nameLength = info->FileNameLength / sizeof(WCHAR);
+        if (nameLength > 1 && info->FileName[nameLength - 1] == L'\0')
+            nameLength -= 1;
+
+        auto& record = records.emplace_back();
+        record.Name = std::wstring_view(info->FileName, nameLength);
+        record.SizeLogical = info->EndOfFile.QuadPart;
+        record.SizePhysical = info->AllocationSize.QuadPart;
+        record.LastWriteTime = { info->LastWriteTime.LowPart, static_cast<DWORD>(info->LastWriteTime.HighPart) };
+        record.Attributes = info->FileAttributes;
+
+        if constexpr (std::is_same_v<InfoType, FILE_ID_EXTD_DIR_INFORMATION>)
+        {
+            // identifiers are kept whole since only NTFS leaves the high part zero
+            record.ReparseTag = info->ReparsePointTag;
+            std::memcpy(record.FileId.Identifier, info->FileId, sizeof(record.FileId.Identifier));
+        }
+        else
+        {
+            // the extended attribute size field holds the tag for reparse points
+            if (info->FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) record.ReparseTag = info->EaSize;
+            if constexpr (std::is_same_v<InfoType, FILE_ID_FULL_DIR_INFORMATION>)
+                std::memcpy(record.FileId.Identifier, &info->FileId.QuadPart, sizeof(info->FileId.QuadPart));
+        }
+
+        if (info->NextEntryOffset == 0) break;
+    }
+}
+
+bool FileFindBackendNt::ReadBatch(std::vector<FileFindRecord>& records)
+{
+    records.clear();
+    if (m_Handle == nullptr) return false;
+
+    if (m_DirectoryInfo.empty())
+    {
+        if (m_SpareBuffers.empty()) m_DirectoryInfo.resize(BUFFER_SIZE_INITIAL);
+        else
+        {
+            m_DirectoryInfo = std::move(m_SpareBuffers.back());
+            m_SpareBuffers.pop_back();
+        }
+    }
+
+    // a directory that filled the buffer in the last query is large
+    // so double the buffer each round it keeps doing so
+    if (m_BufferFilled)
+    {
+        m_BufferSize = std::min(static_cast<ULONG>(m_DirectoryInfo.size()) * 2, BUFFER_SIZE_MAXIMUM);
+    }
+    if (m_DirectoryInfo.size() < m_BufferSize) m_DirectoryInfo.resize(m_BufferSize);
+
+    // handle optional pattern mask
+    UNICODE_STRING uSearch;
+    uSearch.Length = static_cast<USHORT>(m_Search.size() * sizeof(WCHAR));
+    uSearch.MaximumLength = static_cast<USHORT>(m_Search.size() + 1) * sizeof(WCHAR);
+    uSearch.Buffer = m_Search.data();
+
+    // enumerate files in the directory; the richer information classes are
+    // not supported by all file systems so step down until one succeeds
+    IO_STATUS_BLOCK IoStatusBlock;
+    NTSTATUS Status;
+    const int requestedClass = m_InfoClass;
+    while (true)
+    {
+        m_QueryCount++;
+        Status = NtQueryDirectoryFile(m_Handle->m_Handle, nullptr, nullptr, nullptr, &IoStatusBlock,
+            m_DirectoryInfo.data(), static_cast<ULONG>(m_DirectoryInfo.size()), static_cast<FILE_INFORMATION_CLASS>(m_InfoClass),
+            FALSE, (uSearch.Length > 0) ? &uSearch : nullptr, (m_Firstrun) ? TRUE : FALSE);
+        if (Status == 0 || !m_Firstrun || m_InfoClass == FileFullDirectoryInformation) break;
+        m_InfoClass = m_InfoClass == FileIdExtdDirectoryInformation ?
+            FileIdFullDirectoryInformation : FileFullDirectoryInformation;
+    }
+
+    // remember a class that had to be stepped down to for this volume so
+    // that other directories do not have to retry the richer ones
+    if (Status == 0 && m_InfoClass < requestedClass)
+    {
+        m_Handle->m_Volume->m_InfoClass.store(m_InfoClass, std::memory_order_relaxed);
+    }
+
+    m_Firstrun = false;
+    m_Exhausted = Status == StatusNoMoreFiles;
+
+    // release a grown buffer once enough directories completed without growing it
+    if (m_Exhausted)
+    {
+        if (m_BufferSize > BUFFER_SIZE_INITIAL) m_SmallDirectories = 0;
+        else if (m_DirectoryInfo.size() > BUFFER_SIZE_INITIAL && ++m_SmallDirectories > BUFFER_SHRINK_AFTER)
+        {
+            m_DirectoryInfo.resize(BUFFER_SIZE_INITIAL);
+            m_DirectoryInfo.shrink_to_fit();
+            m_SmallDirectories = 0;
+        }
+    }
+    if (Status != 0) return false;
+
+    m_BufferFilled = IoStatusBlock.Information + BUFFER_ENTRY_MAXIMUM > m_DirectoryInfo.size();
+
+    if (m_InfoClass == FileIdExtdDirectoryInformation) ParseBatch<FILE_ID_EXTD_DIR_INFORMATION>(m_DirectoryInfo.data(), records);
+    else if (m_InfoClass == FileIdFullDirectoryInformation) ParseBatch<FILE_ID_FULL_DIR_INFORMATION>(m_DirectoryInfo.data(), records);
+    else ParseBatch<FILE_FULL_DIR_INFORMATION>(m_DirectoryInfo.data(), records);
+    return true;
+}
+
+ULONG FileFindBackendNt::GetQueryCount() const
+{
+    return m_QueryCount;
+}
+
+bool FileFindBackendNt::IsExhausted() const
+{
+    return m_Exhausted;
+}
+
+FileFindBackendCached::FileFindBackendCached(std::unique_ptr<FileFindBackend> backend) :
+    m_Backend(std::move(backend)) {}
+
+bool FileFindBackendCached::Open(const std::wstring& path, const std::wstring& pattern, const Handle& parent, const DWORD attributes)
+{
+    // the directory is always opened so children can still be opened relative to it
+    if (!m_Backend->Open(path, pattern, parent, attributes)) return false;
+
+    // only complete listings are cached; directories on file systems
+    // without stable identifiers are always enumerated
+    const auto& directory = m_Backend->GetHandle();
+    const HANDLE handle = directory->m_Handle;
+    FILE_ID_INFO idInfo;
+    FILE_BASIC_INFO basicInfo;
+    if (!pattern.empty() ||
+        GetFileInformationByHandleEx(handle, FileIdInfo, &idInfo, sizeof(idInfo)) == 0 ||
+        GetFileInformationByHandleEx(handle, FileBasicInfo, &basicInfo, sizeof(basicInfo)) == 0 ||
+        idInfo.VolumeSerialNumber == 0 || std::ranges::all_of(idInfo.FileId.Identifier, [](const BYTE b) { return b == 0; }))
+    {
+        return true;
+    }
+
+    m_Volume = idInfo.VolumeSerialNumber;
+    m_DirectoryId = idInfo.FileId;
+    m_LastWrite = { basicInfo.LastWriteTime.LowPart, static_cast<DWORD>(basicInfo.LastWriteTime.HighPart) };
+
+    // the parent is remembered so that aging can tell which scan root a
+    // listing belongs to; children opened relative to this one find it here
+    directory->m_FileId = idInfo.FileId;
+    if (parent != nullptr) m_ParentId = parent->m_FileId;
+    m_Listing = ScanCache::Get().Lookup(m_Volume, m_DirectoryId, m_ParentId, m_LastWrite);
+    m_Recording = m_Listing == nullptr;
+    return true;
+}
+
+FileFindBackend::Handle FileFindBackendCached::GetHandle() const
+{
+    return m_Backend->GetHandle();
+}
+
+bool FileFindBackendCached::ReadBatch(std::vector<FileFindRecord>& records)
+{
+    // replay the whole listing as a single batch
+    if (m_Listing != nullptr)
+    {
+        records.clear();
+        if (m_Replayed) return false;
+        for (size_t offset = 0; offset < m_Listing->size();)
+        {
+            offset = ScanCache::ReadEntry(*m_Listing, offset, records.emplace_back());
+        }
+        m_Replayed = true;
+        return true;
+    }
+
+    const bool more = m_Backend->ReadBatch(records);
+    if (!m_Recording) return more;
+
+    // the listing is stored once the enumeration has completed
+    if (more)
+    {
+        for (const auto& record : records) ScanCache::AppendEntry(m_Recorded, record);
+    }
+    else
+    {
+        if (m_Backend->IsExhausted()) ScanCache::Get().Store(m_Volume, m_DirectoryId, m_ParentId, m_LastWrite, std::move(m_Recorded));
+        m_Recording = false;
+    }
+    return more;
+}
+
+ULONG FileFindBackendCached::GetQueryCount() const
+{
+    return m_Backend->GetQueryCount();
+}
+
+bool FileFindBackendCached::IsExhausted() const
+{
+    return m_Listing != nullptr ? m_Replayed : m_Backend->IsExhausted();
+}
+
+thread_local std::vector<std::vector<BYTE>> FileFindBackendNt::m_SpareBuffers;
+thread_local ULONG FileFindBackendNt::m_SmallDirectories = 0;
@@ -0,0 +1,221 @@
+﻿// FileFindBackend.h - Declaration of the directory enumeration backends
+//
+// WinDirStat - Directory Statistics
+// Copyright © WinDirStat Team
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#pragma once
+
+#include "stdafx.h"
+#include <atomic>
+#include <climits>
+#include <memory>
+#include <string>
+#include <vector>
+
+//
+// FileFindRecord. A single directory entry as returned by a backend.
+// The name refers to backend storage and is only valid until the next batch.
+//
+struct FileFindRecord final
+{
+    std::wstring_view Name;
+    FILE_ID_128 FileId = {};
+    ULONGLONG SizeLogical = 0;
+    ULONGLONG SizePhysical = 0;
+    FILETIME LastWriteTime = {};
+    DWORD Attributes = INVALID_FILE_ATTRIBUTES;
+    DWORD ReparseTag = 0;
+};
+
+//
+// FileFindBackend. Enumerates one directory in batches of records.
+//
+class FileFindBackend
+{
+public:
+
+    // Volume shared by all directories opened on it
+    using Volume = struct Volume
+    {
+        ULONGLONG m_Serial = 0;
+        std::atomic<int> m_InfoClass = INT_MAX; // richest enumeration class known to work
+    };
+
+    // Open directory along with the volume it resides on
+    using Directory = struct Directory
+    {
+        HANDLE m_Handle = nullptr;
+        std::shared_ptr<Volume> m_Volume;
+        FILE_ID_128 m_FileId = {}; // identifier of the directory if it was looked up
+        ~Directory();
+    };
+    using Handle = std::shared_ptr<Directory>;
+
+    virtual ~FileFindBackend() = default;
+
+    // Opens the directory with the given native path and optional name pattern;
+    // if a parent handle is passed the path is relative to that directory and
+    // the directory shares the volume of its parent unless it is a reparse point
+    virtual bool Open(const std::wstring& path, const std::wstring& pattern, const Handle& parent = {},
+        DWORD attributes = INVALID_FILE_ATTRIBUTES) = 0;
+
+    // Returns the open directory handle so children can be opened relative to it
+    virtual Handle GetHandle() const = 0;
+
+    // Replaces the records with the next batch; returns false when exhausted
+    virtual bool ReadBatch(std::vector<FileFindRecord>& records) = 0;
+
+    // Number of enumeration system calls issued for this directory
+    virtual ULONG GetQueryCount() const = 0;
+
+    // Whether the last batch was not returned because all entries were read
+    virtual bool IsExhausted() const = 0;
+
+    static std::unique_ptr<FileFindBackend> Create();
+};
+
+//
+// FileFindBackendNt. Enumerates using NtQueryDirectoryFile.
+//
+class FileFindBackendNt final : public FileFindBackend
+{
+    using FILE_ID_EXTD_DIR_INFORMATION = struct {
+        ULONG         NextEntryOffset;
+        ULONG         FileIndex;
+        LARGE_INTEGER CreationTime;
+        LARGE_INTEGER LastAccessTime;
+        LARGE_INTEGER LastWriteTime;
+        LARGE_INTEGER ChangeTime;
+        LARGE_INTEGER EndOfFile;
+        LARGE_INTEGER AllocationSize;
+        ULONG         FileAttributes;
+        ULONG         FileNameLength;
+        ULONG         EaSize;
+        ULONG         ReparsePointTag;
+        BYTE          FileId[16];
+        WCHAR         FileName[1];
+    };
+
+    using FILE_ID_FULL_DIR_INFORMATION = struct {
+        ULONG         NextEntryOffset;
+        ULONG         FileIndex;
+        LARGE_INTEGER CreationTime;
+        LARGE_INTEGER LastAccessTime;
+        LARGE_INTEGER LastWriteTime;
+        LARGE_INTEGER ChangeTime;
+        LARGE_INTEGER EndOfFile;
+        LARGE_INTEGER AllocationSize;
+        ULONG         FileAttributes;
+        ULONG         FileNameLength;
+        ULONG         EaSize;
+        LARGE_INTEGER FileId;
+        WCHAR         FileName[1];
+    };
+
+    using FILE_FULL_DIR_INFORMATION = struct {
+        ULONG         NextEntryOffset;
+        ULONG         FileIndex;
+        LARGE_INTEGER CreationTime;
+        LARGE_INTEGER LastAccessTime;
+        LARGE_INTEGER LastWriteTime;
+        LARGE_INTEGER ChangeTime;
+        LARGE_INTEGER EndOfFile;
+        LARGE_INTEGER AllocationSize;
+        ULONG         FileAttributes;
+        ULONG         FileNameLength;
+        ULONG         EaSize;
+        WCHAR         FileName[1];
+    };
+
+    static constexpr int FileFullDirectoryInformation = 2;
+    static constexpr int FileIdFullDirectoryInformation = 38;
+    static constexpr int FileIdExtdDirectoryInformation = 60;
+    static constexpr NTSTATUS StatusNoMoreFiles = static_cast<NTSTATUS>(0x80000006L);
+
+    // Enumeration buffer grows for directories that keep filling it
+    static constexpr ULONG BUFFER_SIZE_INITIAL = 64 * 1024;
+    static constexpr ULONG BUFFER_SIZE_MAXIMUM = 4 * 1024 * 1024;
+    static constexpr ULONG BUFFER_SHRINK_AFTER = 64;
+    static constexpr size_t BUFFER_SPARES = 4;
+
+    // A batch leaving less room than the largest possible entry filled the buffer
+    static constexpr ULONG BUFFER_ENTRY_MAXIMUM = sizeof(FILE_ID_EXTD_DIR_INFORMATION) + 255 * sizeof(WCHAR);
+
+    // Each finder owns its buffer since finders can be nested on a thread and
+    // the names of the records refer to it; buffers of finished finders are
+    // kept per thread for the next ones
+    static thread_local std::vector<std::vector<BYTE>> m_SpareBuffers;
+    static thread_local ULONG m_SmallDirectories;
+
+    std::wstring m_Search;
+    Handle m_Handle;
+    std::vector<BYTE> m_DirectoryInfo;
+    ULONG m_BufferSize = BUFFER_SIZE_INITIAL;
+    ULONG m_QueryCount = 0;
+    bool m_Firstrun = true;
+    bool m_Exhausted = false;
+    bool m_BufferFilled = false;
+    int m_InfoClass = FileIdFullDirectoryInformation;
+
+    template <typename InfoType> void ParseBatch(const BYTE* buffer, std::vector<FileFindRecord>& records) const;
+    static std::shared_ptr<Volume> LookupVolume(HANDLE handle);
+
+public:
+
+    enum class Mode { Compatible = 0, Extended = 1 };
+
+    explicit FileFindBackendNt(Mode mode = Mode::Compatible);
+    ~FileFindBackendNt() override;
+
+    bool Open(const std::wstring& path, const std::wstring& pattern, const Handle& parent = {},
+        DWORD attributes = INVALID_FILE_ATTRIBUTES) override;
+    Handle GetHandle() const override;
+    bool ReadBatch(std::vector<FileFindRecord>& records) override;
+    ULONG GetQueryCount() const override;
+    bool IsExhausted() const override;
+};
+
+//
+// FileFindBackendCached. Replays the entries of a directory from the scan
+// cache if it has not changed since they were recorded; otherwise enumerates
+// it with the wrapped backend and records the entries for the next scan.
+//
+class FileFindBackendCached final : public FileFindBackend
+{
+    std::unique_ptr<FileFindBackend> m_Backend;
+    std::shared_ptr<const std::vector<BYTE>> m_Listing;
+    std::vector<BYTE> m_Recorded;
+    FILETIME m_LastWrite = {};
+    FILE_ID_128 m_DirectoryId = {};
+    FILE_ID_128 m_ParentId = {};
+    ULONGLONG m_Volume = 0;
+    bool m_Recording = false;
+    bool m_Replayed = false;
+
+public:
+
+    explicit FileFindBackendCached(std::unique_ptr<FileFindBackend> backend);
+    ~FileFindBackendCached() override = default;
+
+    bool Open(const std::wstring& path, const std::wstring& pattern, const Handle& parent = {},
+        DWORD attributes = INVALID_FILE_ATTRIBUTES) override;
+    Handle GetHandle() const override;
+    bool ReadBatch(std::vector<FileFindRecord>& records) override;
+    ULONG GetQueryCount() const override;
+    bool IsExhausted() const override;
+};
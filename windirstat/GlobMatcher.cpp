@@ -0,0 +1,167 @@
+﻿// GlobMatcher.cpp - Implementation of GlobMatcher
+//
+// WinDirStat - Directory Statistics
+// Copyright © WinDirStat Team
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#include "stdafx.h"
+#include "GlobMatcher.h"
+
+#include <algorithm>
+#include <map>
+
+namespace
+{
+    enum class TokenType : BYTE { Literal, Any, Star, End };
+
+    struct Token
+    {
+        TokenType type;
+        USHORT charClass;
+    };
+}
+
+bool GlobMatcher::Compile(const std::vector<std::wstring>& patterns)
+{
+    Clear();
+    if (patterns.empty()) return true;
+
+    // Assign each distinct literal its own class; everything else falls into
+    // the shared class which only wildcards can consume
+    m_CharClass.assign(static_cast<size_t>(WCHAR_MAX) + 1, CLASS_OTHER);
+    USHORT nextClass = CLASS_SEPARATOR_FIRST;
+    for (const WCHAR separator : { L'\\', L'/', L':' })
+    {
+        m_CharClass[separator] = nextClass++;
+    }
+    for (const auto& pattern : patterns)
+    {
+        for (const WCHAR c : pattern)
+        {
+            if (c != L'*' && c != L'?' && m_CharClass[c] == CLASS_OTHER) m_CharClass[c] = nextClass++;
+        }
+    }
+    m_ClassCount = nextClass;
+
+    // Flatten all patterns into one sequence of tokens; each pattern ends
+    // in an accepting token and a position is an index into this sequence
+    std::vector<Token> tokens;
+    std::vector<size_t> starts;
+    for (const auto& pattern : patterns)
+    {
+        starts.push_back(tokens.size());
+        for (const WCHAR c : pattern)
+        {
+            if (c == L'*' && tokens.size() > starts.back() && tokens.back().type == TokenType::Star) continue;
+            tokens.push_back(c == L'*' ? Token{ TokenType::Star, 0 } : c == L'?' ?
+                Token{ TokenType::Any, 0 } : Token{ TokenType::Literal, m_CharClass[c] });
+        }
+        tokens.push_back({ TokenType::End, 0 });
+    }
+
+    // A star may match nothing so it also admits the position following it
+    const auto closure = [&tokens](std::vector<size_t>& positions)
+    {
+        for (size_t i = 0; i < positions.size(); i++)
+        {
+            if (tokens[positions[i]].type == TokenType::Star) positions.push_back(positions[i] + 1);
+        }
+        std::ranges::sort(positions);
+        const auto [first, last] = std::ranges::unique(positions);
+        positions.erase(first, last);
+    };
+
+    // Subset construction; state zero is the empty set that never matches
+    std::map<std::vector<size_t>, State> stateIds;
+    std::vector<std::vector<size_t>> states(1);
+    stateIds[{}] = DEAD_STATE;
+    closure(starts);
+    stateIds[starts] = START_STATE;
+    states.push_back(starts);
+
+    for (size_t current = 0; current < states.size(); current++)
+    {
+        m_Accepting.push_back(std::ranges::any_of(states[current],
+            [&tokens](const size_t position) { return tokens[position].type == TokenType::End; }));
+
+        for (USHORT charClass = 0; charClass < m_ClassCount; charClass++)
+        {
+            const bool separator = charClass >= CLASS_SEPARATOR_FIRST && charClass <= CLASS_SEPARATOR_LAST;
+            std::vector<size_t> next;
+            for (const size_t position : states[current])
+            {
+                const Token& token = tokens[position];
+                if (token.type == TokenType::Literal && token.charClass == charClass ||
+                    token.type == TokenType::Any && !separator) next.push_back(position + 1);
+                else if (token.type == TokenType::Star && !separator) next.push_back(position);
+            }
+            closure(next);
+
+            auto [entry, inserted] = stateIds.try_emplace(std::move(next), static_cast<State>(states.size()));
+            if (inserted)
+            {
+                if (states.size() >= MAX_STATES)
+                {
+                    Clear();
+                    return false;
+                }
+                states.push_back(entry->first);
+            }
+            m_Transitions.push_back(entry->second);
+        }
+    }
+
+    return true;
+}
+
+void GlobMatcher::Clear()
+{
+    m_CharClass.clear();
+    m_Transitions.clear();
+    m_Accepting.clear();
+    m_ClassCount = 0;
+}
+
+bool GlobMatcher::IsEmpty() const
+{
+    return m_Transitions.empty();
+}
+
+GlobMatcher::State GlobMatcher::Start() const
+{
+    return IsEmpty() ? DEAD_STATE : START_STATE;
+}
+
+GlobMatcher::State GlobMatcher::Advance(State state, const std::wstring_view text) const
+{
+    for (const WCHAR c : text)
+    {
+        if (state == DEAD_STATE) break;
+        state = m_Transitions[state * m_ClassCount + m_CharClass[c]];
+    }
+    return state;
+}
+
+bool GlobMatcher::IsMatch(const State state) const
+{
+    return state != DEAD_STATE && m_Accepting[state];
+}
+
+bool GlobMatcher::Matches(const std::wstring_view text) const
+{
+    return IsMatch(Advance(Start(), text));
+}
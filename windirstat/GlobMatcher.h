@@ -0,0 +1,67 @@
+﻿// GlobMatcher.h - Declaration of GlobMatcher
+//
+// WinDirStat - Directory Statistics
+// Copyright © WinDirStat Team
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+//
+// GlobMatcher. Matches text against a whole set of glob patterns at once.
+// The patterns are compiled into a single deterministic automaton so that
+// matching costs one table lookup per character and never allocates.
+// As with GlobToRegex(), '*' matches any run and '?' any single character
+// other than a path separator or colon; all other characters are literal.
+//
+class GlobMatcher final
+{
+public:
+    using State = USHORT;
+
+    // Compiles the patterns; returns false if the automaton would be too large
+    // in which case the caller has to fall back to matching each pattern
+    bool Compile(const std::vector<std::wstring>& patterns);
+    void Clear();
+    bool IsEmpty() const;
+
+    // The automaton can be advanced in pieces, e.g. over a parent path once
+    // and then over the name of each child
+    State Start() const;
+    State Advance(State state, std::wstring_view text) const;
+    bool IsMatch(State state) const;
+    bool Matches(std::wstring_view text) const;
+
+private:
+    static constexpr size_t MAX_STATES = 4096;
+    static constexpr State DEAD_STATE = 0;
+    static constexpr State START_STATE = 1;
+
+    // Character classes shared by all patterns; separators are distinct
+    // so that wildcards can exclude them
+    static constexpr USHORT CLASS_OTHER = 0;
+    static constexpr USHORT CLASS_SEPARATOR_FIRST = 1;
+    static constexpr USHORT CLASS_SEPARATOR_LAST = 3;
+
+    std::vector<USHORT> m_CharClass;
+    std::vector<State> m_Transitions;
+    std::vector<bool> m_Accepting;
+    size_t m_ClassCount = 0;
+};
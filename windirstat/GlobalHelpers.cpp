@@ -30,6 +30,7 @@
 #include <algorithm>
 #include <regex>
 #include <map>
+#include <shared_mutex>
 
 #pragma comment(lib,"powrprof.lib") 
 #pragma comment(lib,"ntdll.lib")
@@ -676,6 +677,36 @@ std::wstring GetVolumePathNameEx(const std::wstring & path)
     return fallback;
 }
 
+bool IsRemoteVolume(const std::wstring& volume)
+{
+    // Server names are returned as fallback for shares that cannot be resolved
+    return GetDriveType(volume.c_str()) == DRIVE_REMOTE || volume.starts_with(L"\\\\?\\UNC\\") ||
+        volume.starts_with(L"\\\\") && !volume.starts_with(L"\\\\?\\") ||
+        !volume.empty() && volume.find_first_of(L":\\") == std::wstring::npos;
+}
+
+bool HasSeekPenalty(const std::wstring& volume)
+{
+    // Querying the device properties does not require any access rights
+    std::array<WCHAR, MAX_PATH> name;
+    if (GetVolumeNameForVolumeMountPoint(volume.c_str(), name.data(), static_cast<DWORD>(name.size())) == 0)
+    {
+        return false;
+    }
+    std::wstring device = name.data();
+    if (device.ends_with(L'\\')) device.pop_back();
+
+    SmartPointer<HANDLE> handle(CloseHandle, CreateFile(device.c_str(), 0,
+        FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr));
+    if (handle == INVALID_HANDLE_VALUE) return false;
+
+    STORAGE_PROPERTY_QUERY query = { StorageDeviceSeekPenaltyProperty, PropertyStandardQuery };
+    DEVICE_SEEK_PENALTY_DESCRIPTOR penalty = {};
+    DWORD bytes;
+    return DeviceIoControl(handle, IOCTL_STORAGE_QUERY_PROPERTY, &query, sizeof(query),
+        &penalty, sizeof(penalty), &bytes, nullptr) != 0 && penalty.IncursSeekPenalty;
+}
+
 void DisplayError(const std::wstring& error)
 {
     AfxMessageBox(error.c_str(), MB_OK | MB_ICONERROR);
@@ -791,19 +822,21 @@ std::wstring GetNameFromSid(const PSID sid)
             return memcmp(p1, p2, l1) > 0;
         };
 
-    // attempt to lookup sid in cache
+    // attempt to lookup sid in cache; this is called from several threads
+    // when saving results so the cache is guarded
     static std::map<PSID, std::wstring, decltype(comp)> nameMap(comp);
-    const auto iter = nameMap.find(sid);
-    if (iter != nameMap.end())
+    static std::shared_mutex nameMutex;
     {
-        return iter->second;
+        std::shared_lock lock(nameMutex);
+        const auto iter = nameMap.find(sid);
+        if (iter != nameMap.end())
+        {
+            return iter->second;
+        }
     }
 
-    // copy the sid for storage in our cache table
-    const DWORD sidLength = SidGetLength(sid);
-    const auto sidCopy = std::memcpy(malloc(sidLength), sid, sidLength);
-
     // lookup the name for this sid
+    std::wstring name;
     SID_NAME_USE nameUse;
     WCHAR accountName[UNLEN + 1], domainName[UNLEN + 1];
     DWORD iAccountNameSize = std::size(accountName), iDomainName = std::size(domainName);
@@ -812,16 +845,24 @@ std::wstring GetNameFromSid(const PSID sid)
     {
         SmartPointer<LPWSTR> sidBuff(LocalFree);
         ConvertSidToStringSid(sid, &sidBuff);
-        nameMap[sidCopy] = sidBuff;
+        name = sidBuff;
     }
     else
     {
         // generate full name in domain\name format
-        nameMap[sidCopy] = std::format(L"{}\\{}", domainName, accountName);
+        name = std::format(L"{}\\{}", domainName, accountName);
     }
 
-    // return name
-    return nameMap[sidCopy];
+    // copy the sid for storage in our cache table unless another
+    // thread has stored it in the meantime
+    std::lock_guard lock(nameMutex);
+    if (const auto iter = nameMap.find(sid); iter != nameMap.end())
+    {
+        return iter->second;
+    }
+    const DWORD sidLength = SidGetLength(sid);
+    const auto sidCopy = std::memcpy(malloc(sidLength), sid, sidLength);
+    return nameMap.emplace(sidCopy, std::move(name)).first->second;
 }
 
 IContextMenu* GetContextMenu(const HWND hwnd, const std::vector<std::wstring>& paths)
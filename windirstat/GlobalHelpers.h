@@ -77,6 +77,8 @@ void ProcessMessagesUntilSignaled(const std::function<void()>& callback);
 std::wstring GlobToRegex(const std::wstring& glob);
 std::vector<BYTE> GetCompressedResource(HRSRC resource);
 std::wstring GetVolumePathNameEx(const std::wstring& path);
+bool IsRemoteVolume(const std::wstring& volume);
+bool HasSeekPenalty(const std::wstring& volume);
 void DisplayError(const std::wstring& error);
 std::wstring TranslateError(const HRESULT hr = static_cast<HRESULT>(GetLastError()));
 void DisableHibernate();
@@ -0,0 +1,78 @@
+﻿// IntervalSet.h - Declaration of IntervalSet
+//
+// WinDirStat - Directory Statistics
+// Copyright © WinDirStat Team
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#pragma once
+
+#include <map>
+
+//
+// IntervalSet. A set of disjoint half-open ranges used to remember which
+// clusters of a volume have already been attributed to a file.  Adjacent and
+// overlapping ranges are merged on insertion so the memory needed is bounded
+// by the fragmentation of the volume rather than the number of files.
+//
+class IntervalSet final
+{
+    std::map<ULONGLONG, ULONGLONG> m_Ranges; // start -> end (exclusive)
+
+public:
+
+    // Adds the range and returns how many of its units were not yet present
+    ULONGLONG Insert(const ULONGLONG start, const ULONGLONG length)
+    {
+        if (length == 0) return 0;
+        const ULONGLONG end = start + length;
+        ULONGLONG mergedStart = start;
+        ULONGLONG mergedEnd = end;
+        ULONGLONG covered = 0;
+
+        // start with the range that may overlap or touch the new one from the left
+        auto it = m_Ranges.upper_bound(start);
+        if (it != m_Ranges.begin() && std::prev(it)->second >= start)
+        {
+            --it;
+        }
+
+        // absorb every range overlapping or touching the new one; the stored
+        // ranges are disjoint so their overlaps with the new range add up
+        while (it != m_Ranges.end() && it->first <= end)
+        {
+            const ULONGLONG overlapStart = std::max(start, it->first);
+            const ULONGLONG overlapEnd = std::min(end, it->second);
+            if (overlapEnd > overlapStart) covered += overlapEnd - overlapStart;
+            mergedStart = std::min(mergedStart, it->first);
+            mergedEnd = std::max(mergedEnd, it->second);
+            it = m_Ranges.erase(it);
+        }
+
+        m_Ranges.emplace(mergedStart, mergedEnd);
+        return length - covered;
+    }
+
+    void Clear()
+    {
+        m_Ranges.clear();
+    }
+
+    size_t GetRangeCount() const
+    {
+        return m_Ranges.size();
+    }
+};
@@ -29,25 +29,29 @@
 #include "BlockingQueue.h"
 #include "Localization.h"
 #include "SmartPointer.h"
+#include "IntervalSet.h"
+#include "MftReader.h"
+#include "SubtreeVisitor.h"
 
 #include <string>
 #include <algorithm>
 #include <unordered_set>
 #include <functional>
 #include <shared_mutex>
-#include <stack>
 #include <array>
+#include <ranges>
 
 #pragma comment(lib, "crypt32.lib")
 #pragma comment(lib, "bcrypt.lib")
 
-CItem::CItem(const ITEMTYPE type, const std::wstring & name) : m_Name(name), m_Type(type)
+CItem::CItem(const ITEMTYPE type, const std::wstring_view name) : m_Name(NamePool::Intern(name)), m_Type(type)
 {
     if (IsType(IT_DRIVE))
     {
         // The name string on the drive is two parts separated by a pipe.  For example,
         // C:\|Local Disk (C:) is the true path following by the name description
-        m_Name = std::format(L"{:.2}|{}", m_Name, FormatVolumeNameOfRootPath(m_Name));
+        NamePool::Release(m_Name);
+        m_Name = NamePool::Intern(std::format(L"{:.2}|{}", name, FormatVolumeNameOfRootPath(std::wstring(name))));
         m_Attributes = GetFileAttributesW(GetPathLong().c_str());
     }
 
@@ -57,7 +61,7 @@ CItem::CItem(const ITEMTYPE type, const std::wstring & name) : m_Name(name), m_T
     }
 }
 
-CItem::CItem(const ITEMTYPE type, const std::wstring& name, const FILETIME lastChange,
+CItem::CItem(const ITEMTYPE type, const std::wstring_view name, const FILETIME lastChange,
              const ULONGLONG sizePhysical, const ULONGLONG sizeLogical,
              const DWORD attributes, const ULONG files, const ULONG subdirs) : CItem(type, name)
 {
@@ -76,21 +80,35 @@ CItem::~CItem()
 {
     if (m_FolderInfo != nullptr)
     {
-        for (const auto& m_Child : m_FolderInfo->m_Children)
+        for (const auto& m_Child : m_FolderInfo->m_Children.GetView())
         {
             delete m_Child;
         }
     }
+    else if (m_FileSizesExclusiveCount > 0)
+    {
+        // Files are deleted along with their folder without subtracting sizes
+        auto& shard = GetExclusiveShard();
+        std::lock_guard lock(shard.m_Mutex);
+        if (shard.m_Sizes.erase(this) > 0) --m_FileSizesExclusiveCount;
+    }
+    NamePool::Release(m_Name);
 }
 
 CRect CItem::TmiGetRectangle() const
 {
-    return m_Rect;
+    return { m_Rect.Left, m_Rect.Top, m_Rect.Right, m_Rect.Bottom };
 }
 
 void CItem::TmiSetRectangle(const CRect& rc)
 {
-    m_Rect = rc;
+    // stored with half the precision of a RECT since treemap coordinates
+    // never exceed the size of the view; this is kept for every item
+    constexpr auto narrow = [](const LONG value)
+    {
+        return static_cast<SHORT>(std::clamp<LONG>(value, SHRT_MIN, SHRT_MAX));
+    };
+    m_Rect = { narrow(rc.left), narrow(rc.top), narrow(rc.right), narrow(rc.bottom) };
 }
 
 bool CItem::DrawSubItem(const int subitem, CDC* pdc, CRect rc, const UINT state, int* width, int* focusLeft)
@@ -149,13 +167,14 @@ std::wstring CItem::GetText(const int subitem) const
     {
     case COL_SIZE_PHYSICAL: return FormatBytes(GetSizePhysical());
     case COL_SIZE_LOGICAL: return FormatBytes(GetSizeLogical());
+    case COL_SIZE_EXCLUSIVE: return FormatBytes(GetSizeExclusive());
 
     case COL_NAME:
         if (IsType(IT_DRIVE))
         {
-            return m_Name.substr(std::size(L"?:"));
+            return std::wstring(GetName().substr(std::size(L"?:")));
         }
-        return m_Name;
+        return std::wstring(GetName());
 
     case COL_OWNER:
         if (IsType(IT_FILE | IT_DIRECTORY))
@@ -259,7 +278,7 @@ int CItem::CompareSibling(const CTreeListItem* tlib, const int subitem) const
     {
         case COL_NAME:
         {
-            return signum(_wcsicmp(m_Name.c_str(), other->m_Name.c_str()));
+            return signum(_wcsicmp(m_Name, other->m_Name));
         }
 
         case COL_SUBTREEPERCENTAGE:
@@ -289,6 +308,11 @@ int CItem::CompareSibling(const CTreeListItem* tlib, const int subitem) const
             return usignum(GetSizeLogical(), other->GetSizeLogical());
         }
 
+        case COL_SIZE_EXCLUSIVE:
+        {
+            return usignum(GetSizeExclusive(), other->GetSizeExclusive());
+        }
+
         case COL_ITEMS:
         {
             return usignum(GetItemsCount(), other->GetItemsCount());
@@ -472,17 +496,20 @@ void CItem::UpdateStatsFromDisk()
     if (IsType(IT_DIRECTORY | IT_FILE))
     {
         FileFindEnhanced finder;
-        if (finder.FindFile(GetFolderPath(),IsType(ITF_ROOTITEM) ? std::wstring() : GetName(), GetAttributes()))
+        if (finder.FindFile(GetFolderPath(),IsType(ITF_ROOTITEM) ? std::wstring() : std::wstring(GetName()), GetAttributes()))
         {
             SetLastChange(finder.GetLastWriteTime());
             SetAttributes(finder.GetAttributes());
 
             if (IsType(IT_FILE))
             {
+                // Additional hard links keep contributing no physical size; the
+                // exclusive size is added again once the file has been remapped
                 ExtensionDataRemove();
                 UpwardSubtractSizePhysical(m_SizePhysical);
                 UpwardSubtractSizeLogical(m_SizeLogical);
-                UpwardAddSizePhysical(finder.GetFileSizePhysical());
+                UpwardSubtractSizeExclusive(GetSizeExclusive());
+                if (!IsType(ITF_HARDLINK)) UpwardAddSizePhysical(finder.GetFileSizePhysical());
                 UpwardAddSizeLogical(finder.GetFileSizeLogical());
                 ExtensionDataAdd();
             }
@@ -500,9 +527,9 @@ void CItem::UpdateStatsFromDisk()
     }
 }
 
-const std::vector<CItem*>& CItem::GetChildren() const
+ChildList<CItem*>::View CItem::GetChildren() const
 {
-    return m_FolderInfo->m_Children;
+    return m_FolderInfo->m_Children.GetView();
 }
 
 CItem* CItem::GetParent() const
@@ -516,14 +543,14 @@ void CItem::AddChild(CItem* child, const bool addOnly)
     {
         UpwardAddSizePhysical(child->m_SizePhysical);
         UpwardAddSizeLogical(child->m_SizeLogical);
+        UpwardAddSizeExclusive(child->GetSizeExclusive());
         UpwardUpdateLastChange(child->m_LastChange);
         ExtensionDataAdd();
     }
 
     child->SetParent(this);
 
-    std::lock_guard guard(m_FolderInfo->m_Protect);
-    m_FolderInfo->m_Children.push_back(child);
+    m_FolderInfo->m_Children.Add(child);
 
     if (IsVisible() && IsExpanded())
     {
@@ -536,8 +563,7 @@ void CItem::AddChild(CItem* child, const bool addOnly)
 
 void CItem::RemoveChild(CItem* child)
 {
-    std::lock_guard guard(m_FolderInfo->m_Protect);
-    std::erase(m_FolderInfo->m_Children, child);
+    m_FolderInfo->m_Children.Remove(child);
 
     if (IsVisible())
     {
@@ -563,13 +589,13 @@ void CItem::RemoveAllChildren()
         CFileTreeControl::Get()->OnRemovingAllChildren(this);
     });
 
-    std::lock_guard guard(m_FolderInfo->m_Protect);
-    for (const auto& child : m_FolderInfo->m_Children)
+    // Children are unpublished before being deleted
+    const auto children = GetChildren();
+    m_FolderInfo->m_Children.Clear();
+    for (const auto& child : children)
     {
         delete child;
     }
-    m_FolderInfo->m_Children.clear();
-    
 }
 
 void CItem::UpwardAddFolders(const ULONG dirCount)
@@ -652,6 +678,47 @@ void CItem::UpwardSubtractSizeLogical(const ULONGLONG bytes)
     }
 }
 
+void CItem::UpwardAddSizeExclusive(const ULONGLONG bytes)
+{
+    if (bytes == 0) return;
+    for (auto p = this; p != nullptr; p = p->GetParent())
+    {
+        if (p->m_FolderInfo != nullptr)
+        {
+            p->m_FolderInfo->m_SizeExclusive += bytes;
+            continue;
+        }
+
+        auto& shard = p->GetExclusiveShard();
+        std::lock_guard lock(shard.m_Mutex);
+        if (const auto [size, added] = shard.m_Sizes.try_emplace(p, bytes); !added) size->second += bytes;
+        else ++m_FileSizesExclusiveCount;
+    }
+}
+
+void CItem::UpwardSubtractSizeExclusive(const ULONGLONG bytes)
+{
+    if (bytes == 0) return;
+    for (auto p = this; p != nullptr; p = p->GetParent())
+    {
+        if (p->m_FolderInfo != nullptr)
+        {
+            ASSERT(p->m_FolderInfo->m_SizeExclusive >= bytes);
+            p->m_FolderInfo->m_SizeExclusive -= bytes;
+            continue;
+        }
+
+        auto& shard = p->GetExclusiveShard();
+        std::lock_guard lock(shard.m_Mutex);
+        const auto size = shard.m_Sizes.find(p);
+        if (size == shard.m_Sizes.end()) continue;
+        ASSERT(size->second >= bytes);
+        if ((size->second -= bytes) > 0) continue;
+        shard.m_Sizes.erase(size);
+        --m_FileSizesExclusiveCount;
+    }
+}
+
 void CItem::ExtensionDataAdd() const
 {
     if (!IsType(IT_FILE)) return;
@@ -671,45 +738,54 @@ void CItem::ExtensionDataRemove() const
 
 void CItem::ExtensionDataRemoveChildren() const
 {
-    std::stack<const CItem*> childStack({ this });
-    while (!childStack.empty())
+    // Totals are gathered per extension so the shared records are only
+    // updated once per extension and worker
+    using EXTENSIONTOTALS = std::unordered_map<std::wstring, std::pair<ULONGLONG, ULONGLONG>>;
+    SubtreeVisitor<CItem>::Visit<EXTENSIONTOTALS>(const_cast<CItem*>(this), [](EXTENSIONTOTALS& totals, const CItem* item)
     {
-        const auto& item = childStack.top();
-        childStack.pop();
-
-        if (item->IsType(IT_MYCOMPUTER | IT_DIRECTORY | IT_DRIVE))
+        if (item->IsType(IT_FILE))
         {
-            for (const auto& child : item->GetChildren())
-            {
-                childStack.push(child);
-            }
+            auto& [bytes, files] = totals[item->GetExtension()];
+            bytes += item->GetSizePhysical();
+            files += 1;
         }
-        else if (IsType(IT_FILE))
+        return item->IsType(IT_MYCOMPUTER | IT_DIRECTORY | IT_DRIVE);
+    },
+    [](EXTENSIONTOTALS& totals)
+    {
+        const auto doc = CDirStatDoc::GetDocument();
+        for (const auto& [extension, total] : totals)
         {
-            item->ExtensionDataRemove();
+            const auto record = doc->GetExtensionDataRecord(extension);
+            record->bytes -= total.first;
+            record->files -= total.second;
+            if (record->files == 0) doc->GetExtensionData()->erase(extension);
         }
-    }
+    });
 }
 
-void CItem::UpwardAddReadJobs(const ULONG count)
+void CItem::UpwardAddPendingJob()
 {
-    if (m_FolderInfo == nullptr || count == 0) return;
-    if (m_FolderInfo->m_Jobs == 0) m_FolderInfo->m_Tstart = static_cast<ULONG>(GetTickCount64() / 1000ull);
-    for (auto p = this; p != nullptr; p = p->GetParent())
+    // A refreshed file is counted as a job of its parent folder
+    const auto start = IsType(IT_FILE) ? GetParent() : this;
+    if (start == nullptr || start->m_FolderInfo == nullptr) return;
+    if (start->m_FolderInfo->m_Jobs == 0) start->m_FolderInfo->m_Tstart = static_cast<ULONG>(GetTickCount64() / 1000ull);
+
+    // Only a node that had nothing pending registers itself with its parent
+    for (auto p = start; p != nullptr; p = p->GetParent())
     {
-        if (p->IsType(IT_FILE)) continue;
-        p->m_FolderInfo->m_Jobs += count;
+        if (p->m_FolderInfo->m_Jobs++ > 0) break;
     }
 }
 
-void CItem::UpwardSubtractReadJobs(const ULONG count)
+void CItem::UpwardCompletePendingJob()
 {
-    if (count == 0 || IsType(IT_FILE)) return;
-    for (auto p = this; p != nullptr; p = p->GetParent())
+    // Completion cascades to the parent only once a node has nothing pending
+    for (auto p = IsType(IT_FILE) ? GetParent() : this; p != nullptr; p = p->GetParent())
     {
-        ASSERT(p->m_FolderInfo->m_Jobs - count >= 0);
-        p->m_FolderInfo->m_Jobs -= count;
-        if (p->m_FolderInfo->m_Jobs == 0) p->SetDone();
+        ASSERT(p->m_FolderInfo->m_Jobs > 0);
+        if (--p->m_FolderInfo->m_Jobs > 0) break;
+        p->SetDone();
     }
 }
 
@@ -748,6 +824,21 @@ ULONGLONG CItem::GetSizeLogical() const
     return m_SizeLogical;
 }
 
+ULONGLONG CItem::GetSizeExclusive() const
+{
+    if (m_FolderInfo != nullptr) return m_FolderInfo->m_SizeExclusive;
+
+    auto& shard = GetExclusiveShard();
+    std::lock_guard lock(shard.m_Mutex);
+    const auto size = shard.m_Sizes.find(this);
+    return size != shard.m_Sizes.end() ? size->second : 0;
+}
+
+CItem::EXCLUSIVESHARD& CItem::GetExclusiveShard() const
+{
+    return m_FileSizesExclusive[std::hash<const CItem*>{}(this) % EXCLUSIVE_SHARDS];
+}
+
 void CItem::SetSizePhysical(const ULONGLONG size)
 {
     ASSERT(size >= 0);
@@ -762,8 +853,30 @@ void CItem::SetSizeLogical(const ULONGLONG size)
 
 ULONG CItem::GetReadJobs() const
 {
-    if (m_FolderInfo == nullptr) return 0;
-    return m_FolderInfo->m_Jobs;
+    if (m_FolderInfo == nullptr || m_FolderInfo->m_Jobs == 0) return 0;
+
+    // Counting requires walking the pending subtree so it is
+    // only done once per user interface refresh for each node
+    if (m_FolderInfo->m_JobsSampleEpoch == m_ReadJobsEpoch) return m_FolderInfo->m_JobsSample;
+
+    // Replace each pending child in our own count with the count of its subtree
+    LONGLONG own = m_FolderInfo->m_Jobs;
+    ULONG jobs = 0;
+    for (const auto& child : GetChildren())
+    {
+        if (child->m_FolderInfo == nullptr || child->m_FolderInfo->m_Jobs == 0) continue;
+        jobs += child->GetReadJobs();
+        own--;
+    }
+
+    m_FolderInfo->m_JobsSample = jobs + static_cast<ULONG>(max(own, 0ll));
+    m_FolderInfo->m_JobsSampleEpoch = m_ReadJobsEpoch;
+    return m_FolderInfo->m_JobsSample;
+}
+
+void CItem::ResampleReadJobs()
+{
+    ++m_ReadJobsEpoch;
 }
 
 FILETIME CItem::GetLastChange() const
@@ -876,15 +989,15 @@ std::wstring CItem::GetFolderPath() const
     return path;
 }
 
-std::wstring CItem::GetName() const
+std::wstring_view CItem::GetName() const
 {
-    return m_Name;
+    return NamePool::Get(m_Name);
 }
 
 std::wstring CItem::GetExtension() const
 {
-    if (!IsType(IT_FILE)) return m_Name;
-    const LPCWSTR ext = wcsrchr(m_Name.c_str(), L'.');
+    if (!IsType(IT_FILE)) return std::wstring(GetName());
+    const LPCWSTR ext = wcsrchr(m_Name, L'.');
     if (ext == nullptr) return L"";
     std::wstring extLower = ext;
     _wcslwr_s(extLower.data(), extLower.size() + 1);
@@ -938,11 +1051,9 @@ void CItem::SortItemsBySizePhysical() const
     if (m_FolderInfo == nullptr) return;
     
     // sort by size for proper treemap rendering
-    std::lock_guard guard(m_FolderInfo->m_Protect);
-    m_FolderInfo->m_Children.shrink_to_fit();
-    std::ranges::sort(m_FolderInfo->m_Children, [](auto item1, auto item2)
+    m_FolderInfo->m_Children.Sort(std::greater<>(), [](const CItem* item)
     {
-        return item1->GetSizePhysical() > item2->GetSizePhysical(); // biggest first
+        return item->GetSizePhysical(); // biggest first
     });
 }
 
@@ -964,32 +1075,68 @@ void CItem::ResetScanStartTime() const
 
 void CItem::ScanItemsFinalize(CItem* item)
 {
-    if (item == nullptr) return;
-    std::stack<CItem*> queue({item});
-    while (!queue.empty())
+    SubtreeVisitor<CItem>::Visit(item, [item](CItem* qitem)
     {
-        const auto & qitem = queue.top();
-        queue.pop();
+        // Subtrees completed during the scan are left as they are
+        if (qitem != item && qitem->IsDone()) return false;
         qitem->SetDone();
-        if (qitem->IsType(IT_FILE)) continue;
-        for (const auto& child : qitem->GetChildren())
-        {
-            if (!child->IsDone()) queue.push(child);
-        }
-    }
+        if (qitem->IsType(IT_FILE)) return false;
+
+        // Release parent handles held by directories left unscanned
+        qitem->m_FolderInfo->m_ParentHandle.reset();
+        return true;
+    });
 }
 
-void CItem::ScanItems(BlockingQueue<CItem*> * queue)
+void CItem::ScanItems(BlockingQueue<CItem*> * queue, BlockingQueue<CItem*> * sizeQueue, BlockingQueue<CItem*> * extentQueue)
 {
+    bool background = false;
     while (CItem * item = queue->Pop())
     {
         // Mark the time we started evaluating this node
         item->ResetScanStartTime();
+        PublishActiveItem(item);
 
-        if (item->IsType(IT_DRIVE | IT_DIRECTORY))
+        // Low disk priority can be toggled while scanning
+        if (background != COptions::ScanningBackgroundMode)
+        {
+            background = COptions::ScanningBackgroundMode;
+            SetThreadPriority(GetCurrentThread(), background ? THREAD_MODE_BACKGROUND_BEGIN : THREAD_MODE_BACKGROUND_END);
+        }
+
+        // Items stolen from another volume are pushed back to that volume's queue
+        const auto itemQueue = queue->GetItemQueue();
+
+        if (item->IsType(IT_DRIVE) && COptions::ScanningMasterFileTable &&
+            item->ScanMasterFileTable(itemQueue, extentQueue))
+        {
+            VTRACE(L"Read master file table: {}", item->GetPath());
+        }
+        else if (item->IsType(IT_DRIVE | IT_DIRECTORY))
         {
+            // Nothing is enumerated if cancelled while waiting on the folder limit
+            const bool proceed = itemQueue->Throttle(m_FolderLimiter, 1.0);
+
+            // Open relative to the parent directory handle if one was passed down
             FileFindEnhanced finder;
-            for (BOOL b = finder.FindFile(item->GetPath(), L"", item->GetAttributes()); b; b = finder.FindNextFile())
+            const auto parentHandle = std::move(item->m_FolderInfo->m_ParentHandle);
+            const BOOL found = proceed && (parentHandle != nullptr ?
+                finder.FindFile(parentHandle, std::wstring(item->GetName()), [item] { return item->GetPath(); }, item->GetAttributes()) :
+                finder.FindFile(item->GetPath(), L"", item->GetAttributes()));
+            SCANTOTALS totals;
+
+            // Directory filters match the full path so advance the automaton
+            // over the path of this directory once for all of its children
+            const auto& dirsMatcher = COptions::FilteringExcludeDirsMatcher;
+            GlobMatcher::State dirsState = dirsMatcher.Start();
+            if (!dirsMatcher.IsEmpty())
+            {
+                const std::wstring path = item->GetPath();
+                dirsState = dirsMatcher.Advance(dirsState, path);
+                if (path.empty() || path.back() != L'\\') dirsState = dirsMatcher.Advance(dirsState, L"\\");
+            }
+
+            for (BOOL b = found; b; b = finder.FindNextFile())
             {
                 if (finder.IsDots())
                 {
@@ -1005,70 +1152,336 @@ void CItem::ScanItems(BlockingQueue<CItem*> * queue)
                     }
   
                     // Exclude directories matching path filter
+                    if (!dirsMatcher.IsEmpty() && dirsMatcher.IsMatch(dirsMatcher.Advance(dirsState, finder.GetFileName())))
+                    {
+                        continue;
+                    }
                     if (!COptions::FilteringExcludeDirsRegex.empty() && std::ranges::any_of(COptions::FilteringExcludeDirsRegex,
                         [&finder](const auto& pattern) { return std::regex_match(finder.GetFilePath(), pattern); }))
                     {
                         continue;
                     }
 
-                    item->UpwardAddFolders(1);
-                    if (CItem* newitem = item->AddDirectory(finder); newitem->GetReadJobs() > 0)
+                    CItem* newitem = item->AddDirectory(finder);
+                    totals.Add(newitem);
+                    if (newitem->m_FolderInfo->m_Jobs > 0)
                     {
-                        queue->Push(newitem);
+                        // Keep our handle open so the child can be opened relative to it
+                        newitem->m_FolderInfo->m_ParentHandle = finder.GetHandle();
+                        itemQueue->Push(newitem);
                     }
                 }
                 else
                 {
-                    if (COptions::ExcludeHiddenFile && finder.IsHidden() ||
-                        COptions::ExcludeProtectedFile && finder.IsHiddenSystem() ||
-                        COptions::ExcludeSymbolicLinksFile && CReparsePoints::IsReparsePoint(finder.GetAttributes()) &&
-                            CReparsePoints::IsSymbolicLink(finder.GetFilePathLong(), finder.GetAttributes()))
+                    if (IsExcludedFile(finder))
                     {
                         continue;
                     }
 
-                    // Exclude files matching name filter
-                    if (!COptions::FilteringExcludeFilesRegex.empty() && std::ranges::any_of(COptions::FilteringExcludeFilesRegex,
-                        [&finder](const auto& pattern) { return std::regex_match(finder.GetFileName(), pattern); }))
+                    CItem* newitem = item->AddFile(finder);
+
+                    // Only the first link to a file found during the scan counts towards
+                    // the physical size; file identifiers are unique per volume which
+                    // followed junctions and mount points can change within a scan root
+                    if (COptions::ProcessHardlinks && !newitem->RegisterFileId(finder.GetVolumeSerial(), finder.GetFileId()))
                     {
-                        continue;
+                        newitem->SetType(ITF_HARDLINK);
+                        newitem->SetSizePhysical(0);
                     }
+                    newitem->ExtensionDataAdd();
+                    totals.Add(newitem);
 
-                    // Exclude files matching size filter
-                    if (COptions::FilteringSizeMinimumCalculated > 0 && finder.GetFileSizeLogical() < COptions::FilteringSizeMinimumCalculated)
+                    // Additional hard links share the data of the first so they are
+                    // neither hashed nor sized again
+                    if (!newitem->IsType(ITF_HARDLINK))
                     {
-                        continue;
+                        CFileDupeControl::Get()->ProcessDuplicate(newitem, itemQueue);
+
+                        // Files without an allocation size are resolved by the background
+                        // pool which also adds them to the largest files and maps their
+                        // clusters once sized; clusters shared with files mapped earlier
+                        // are not exclusive
+                        if (!finder.IsFileSizePhysicalKnown()) sizeQueue->Push(newitem);
+                        else
+                        {
+                            CFileTopControl::Get()->ProcessTop(newitem);
+                            if (extentQueue != nullptr) extentQueue->Push(newitem);
+                        }
                     }
-
-                    item->UpwardAddFiles(1);
-                    CItem* newitem = item->AddFile(finder);
-                    CFileDupeControl::Get()->ProcessDuplicate(newitem, queue);
-                    CFileTopControl::Get()->ProcessTop(newitem);
-                    queue->WaitIfSuspended();
+                    if (!itemQueue->WaitIfSuspended()) break;
                 }
 
-                // Update pacman position
-                item->UpwardDrivePacman();
+                // Publish partial totals of very large directories for live progress
+                if (++totals.m_Entries >= 1024) item->UpwardPublishTotals(totals);
+            }
+            item->UpwardPublishTotals(totals);
+
+            // Report directories that needed many enumeration calls
+            if (finder.GetQueryCount() > 4)
+            {
+                VTRACE(L"Enumeration calls {}: {}", finder.GetQueryCount(), item->GetPath());
             }
         }
         else if (item->IsType(IT_FILE))
         {
             // Only used for refreshes
             item->UpdateStatsFromDisk();
-            CFileDupeControl::Get()->ProcessDuplicate(item, queue);
+            CFileDupeControl::Get()->ProcessDuplicate(item, itemQueue);
             CFileTopControl::Get()->ProcessTop(item);
+            if (extentQueue != nullptr && !item->IsType(ITF_HARDLINK)) extentQueue->Push(item);
             item->SetDone();
         }
         else if (item->IsType(IT_MYCOMPUTER))
         {
             for (const auto & child : item->GetChildren())
             {
-                child->UpwardAddReadJobs(1);
-                queue->Push(child);
+                child->UpwardAddPendingJob();
+                itemQueue->Push(child);
+            }
+        }
+        item->UpwardCompletePendingJob();
+        PublishActiveItem(nullptr);
+    }
+}
+
+bool CItem::ScanMasterFileTable(BlockingQueue<CItem*>* queue, BlockingQueue<CItem*>* extentQueue)
+{
+    // Only local volumes can be read directly and opening them requires
+    // administrative rights; the caller enumerates the volume otherwise
+    const std::wstring volume = GetPath();
+    MftReader reader;
+    std::vector<MftReader::MFTRECORD> records;
+    std::vector<MftReader::MFTLINK> links;
+    if (volume.size() < 2 || volume[1] != L':' || !reader.Open(L"\\\\.\\" + volume.substr(0, 2)))
+    {
+        return false;
+    }
+
+    // A cancelled read leaves nothing for the caller to fall back to
+    if (!reader.Read(records, links, COptions::ScanningThreads, queue->GetStopToken()))
+    {
+        return queue->IsCancelled();
+    }
+
+    // Group the names by parent so the entries of a directory are adjacent
+    std::ranges::sort(links, {}, &MftReader::MFTLINK::m_Parent);
+
+    // Rebuild the tree from the root directory down; only the first name of
+    // a file with several hard links counts towards the physical size
+    const bool filterDirectories = !COptions::FilteringExcludeDirsMatcher.IsEmpty() ||
+        !COptions::FilteringExcludeDirsRegex.empty();
+    std::vector<bool> seen(records.size());
+    std::vector<CItem*> directories;
+    std::vector<std::pair<CItem*, ULONG>> pending = { { this, MftReader::ROOT_RECORD } };
+    while (!pending.empty())
+    {
+        const auto [item, parent] = pending.back();
+        pending.pop_back();
+        PublishActiveItem(item);
+
+        std::wstring base = filterDirectories ? item->GetPath() : std::wstring();
+        if (filterDirectories && base.back() != L'\\') base += L'\\';
+
+        SCANTOTALS totals;
+        const auto [first, last] = std::ranges::equal_range(links, parent, {}, &MftReader::MFTLINK::m_Parent);
+        for (const auto& link : std::ranges::subrange(first, last))
+        {
+            // Metadata files are not visible when enumerating
+            if (link.m_Record < MftReader::FIRST_USER_RECORD || link.m_Record >= records.size() ||
+                !records[link.m_Record].m_InUse)
+            {
+                continue;
+            }
+
+            const auto& record = records[link.m_Record];
+            if ((record.m_Attributes & FILE_ATTRIBUTE_DIRECTORY) != 0)
+            {
+                if (seen[link.m_Record] || IsExcludedDirectory(base + link.m_Name, record.m_Attributes))
+                {
+                    continue;
+                }
+                seen[link.m_Record] = true;
+
+                const auto child = new CItem(IT_DIRECTORY, link.m_Name);
+                child->SetLastChange(record.m_LastWrite);
+                child->SetAttributes(record.m_Attributes);
+                item->AddChild(child, true);
+                totals.Add(child);
+                directories.push_back(child);
+
+                // Reparse points lead elsewhere and have no entries of their own
+                if (!CReparsePoints::IsReparsePoint(record.m_Attributes)) pending.emplace_back(child, link.m_Record);
+            }
+            else
+            {
+                if (IsExcludedFile(link.m_Name, record.m_Attributes, record.m_SizeLogical, record.m_ReparseTag))
+                {
+                    continue;
+                }
+
+                const auto child = new CItem(IT_FILE, link.m_Name);
+                child->SetSizePhysical(record.m_SizePhysical);
+                child->SetSizeLogical(record.m_SizeLogical);
+                child->SetLastChange(record.m_LastWrite);
+                child->SetAttributes(record.m_Attributes);
+                item->AddChild(child, true);
+                child->SetDone();
+
+                if (COptions::ProcessHardlinks && seen[link.m_Record])
+                {
+                    child->SetType(ITF_HARDLINK);
+                    child->SetSizePhysical(0);
+                }
+                seen[link.m_Record] = true;
+                child->ExtensionDataAdd();
+                totals.Add(child);
+
+                if (!child->IsType(ITF_HARDLINK))
+                {
+                    CFileDupeControl::Get()->ProcessDuplicate(child, queue);
+                    CFileTopControl::Get()->ProcessTop(child);
+                    if (extentQueue != nullptr) extentQueue->Push(child);
+                }
+            }
+
+            // Publish partial totals of very large directories for live progress
+            if (++totals.m_Entries >= 1024) item->UpwardPublishTotals(totals);
+        }
+        item->UpwardPublishTotals(totals);
+        if (!queue->WaitIfSuspended()) break;
+    }
+
+    // Directories are sorted once everything below them has been added
+    for (const auto& directory : directories | std::views::reverse)
+    {
+        directory->SetDone();
+    }
+    return true;
+}
+
+void CItem::ScanItemsPhysicalSize(BlockingQueue<CItem*>* queue, BlockingQueue<CItem*>* extentQueue)
+{
+    // These require opening each file by path so run in background mode
+    // to keep them from competing with enumeration for the disk
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+
+    while (CItem* item = queue->Pop())
+    {
+        // The item was added with no physical size so add the resolved
+        // size to it, all of its ancestors and its extension
+        DWORD highPart;
+        const DWORD lowPart = GetCompressedFileSize(item->GetPathLong().c_str(), &highPart);
+        if (const ULONGLONG size = static_cast<ULONGLONG>(highPart) << 32 | lowPart;
+            size != 0 && (lowPart != INVALID_FILE_SIZE || GetLastError() == NO_ERROR))
+        {
+            item->UpwardAddSizePhysical(size);
+            CDirStatDoc::GetDocument()->GetExtensionDataRecord(item->GetExtension())->bytes += size;
+
+            // Files of a folder are mostly resolved in a row
+            thread_local CItem* lastParent = nullptr;
+            if (item->GetParent() != lastParent)
+            {
+                lastParent = item->GetParent();
+                std::lock_guard lock(m_ResizedMutex);
+                m_ResizedFolders.insert(lastParent);
+            }
+        }
+
+        CFileTopControl::Get()->ProcessTop(item);
+
+        // Shared clusters are only attributed once the physical size is known
+        if (extentQueue != nullptr) extentQueue->Push(item);
+        queue->WaitIfSuspended();
+    }
+}
+
+void CItem::ScanItemsResort()
+{
+    // Called once the physical sizes are resolved; the size changed for all
+    // ancestors so each completed one is sorted again; the others are sorted
+    // when they are finalized
+    std::unordered_set<CItem*> visited;
+    std::lock_guard lock(m_ResizedMutex);
+    for (const auto& folder : m_ResizedFolders)
+    {
+        for (auto p = folder; p != nullptr && visited.insert(p).second; p = p->GetParent())
+        {
+            if (p->IsDone()) p->SortItemsBySizePhysical();
+        }
+    }
+    m_ResizedFolders.clear();
+}
+
+void CItem::ScanItemsExtents(BlockingQueue<CItem*>* queue)
+{
+    // Clusters attributed to a file so far by volume serial number; a single
+    // thread maps the files as they are found so no locking is needed and
+    // the first file found referencing a shared cluster is the one to own it
+    using EXTENTVOLUME = struct EXTENTVOLUME
+    {
+        ULONGLONG m_ClusterSize = 0;
+        IntervalSet m_Clusters;
+    };
+    std::unordered_map<DWORD, EXTENTVOLUME> volumes;
+    std::vector<BYTE> buffer(64 * 1024);
+
+    // Mapping opens every file so do not compete with the enumeration
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+
+    while (CItem* item = queue->Pop())
+    {
+        ULONGLONG exclusive = item->GetSizePhysical();
+        const std::wstring path = item->GetPathLong();
+        SmartPointer<HANDLE> handle(CloseHandle, CreateFile(path.c_str(), FILE_READ_ATTRIBUTES,
+            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr));
+
+        BY_HANDLE_FILE_INFORMATION info;
+        if (handle != INVALID_HANDLE_VALUE && GetFileInformationByHandle(handle, &info) != 0)
+        {
+            auto& volume = volumes[info.dwVolumeSerialNumber];
+            if (volume.m_ClusterSize == 0)
+            {
+                DWORD sectorsPerCluster, bytesPerSector, freeClusters, totalClusters;
+                volume.m_ClusterSize = GetDiskFreeSpace(GetVolumePathNameEx(path).c_str(),
+                    &sectorsPerCluster, &bytesPerSector, &freeClusters, &totalClusters) != 0 ?
+                    static_cast<ULONGLONG>(sectorsPerCluster) * bytesPerSector : ULONGLONG_MAX;
+            }
+
+            // Walk the runs of the file and claim the clusters not yet seen;
+            // sparse and compressed runs have no clusters behind them
+            STARTING_VCN_INPUT_BUFFER input = {};
+            ULONGLONG claimed = 0;
+            bool mapped = false;
+            DWORD bytes;
+            while (volume.m_ClusterSize != ULONGLONG_MAX)
+            {
+                const BOOL done = DeviceIoControl(handle, FSCTL_GET_RETRIEVAL_POINTERS, &input, sizeof(input),
+                    buffer.data(), static_cast<DWORD>(buffer.size()), &bytes, nullptr);
+                if (done == 0 && GetLastError() != ERROR_MORE_DATA) break;
+
+                const auto pointers = reinterpret_cast<const RETRIEVAL_POINTERS_BUFFER*>(buffer.data());
+                LONGLONG vcn = pointers->StartingVcn.QuadPart;
+                for (DWORD i = 0; i < pointers->ExtentCount; i++)
+                {
+                    const auto& extent = pointers->Extents[i];
+                    if (extent.Lcn.QuadPart != -1)
+                    {
+                        claimed += volume.m_Clusters.Insert(extent.Lcn.QuadPart, extent.NextVcn.QuadPart - vcn);
+                    }
+                    vcn = extent.NextVcn.QuadPart;
+                }
+
+                mapped = true;
+                if (done != 0 || pointers->ExtentCount == 0) break;
+                input.StartingVcn.QuadPart = vcn;
             }
+
+            // Files stored within the file record have no runs to map
+            if (mapped) exclusive = claimed * volume.m_ClusterSize;
         }
-        item->UpwardSubtractReadJobs(1);
-        item->UpwardDrivePacman();
+
+        item->UpwardAddSizeExclusive(exclusive);
+        queue->WaitIfSuspended();
     }
 }
 
@@ -1109,7 +1522,7 @@ CItem* CItem::FindRecyclerItem() const
         {
             for (const auto& child : p->GetChildren())
             {
-                if (child->IsType(IT_DIRECTORY) && _wcsicmp(child->GetName().c_str(), possible.c_str()) == 0)
+                if (child->IsType(IT_DIRECTORY) && _wcsicmp(child->m_Name, possible.c_str()) == 0)
                 {
                     return child;
                 }
@@ -1120,6 +1533,108 @@ CItem* CItem::FindRecyclerItem() const
     return nullptr;
 }
 
+CItem* CItem::FindItemByPath(const std::wstring& path)
+{
+    if (IsType(IT_MYCOMPUTER))
+    {
+        for (const auto& child : GetChildren())
+        {
+            if (CItem* item = child->FindItemByPath(path); item != nullptr) return item;
+        }
+        return nullptr;
+    }
+
+    // This item has to be the path itself or one of its folders
+    const std::wstring base = GetPath();
+    if (path.size() < base.size() || _wcsnicmp(path.c_str(), base.c_str(), base.size()) != 0) return nullptr;
+    size_t start = base.size();
+    if (start < path.size() && base.back() != L'\\' && path[start++] != L'\\') return nullptr;
+
+    // Descend one path component at a time
+    CItem* item = this;
+    while (item != nullptr && start < path.size())
+    {
+        if (item->IsType(IT_FILE)) return nullptr;
+        const size_t end = std::min(path.find(L'\\', start), path.size());
+        const std::wstring name = path.substr(start, end - start);
+        const auto& children = item->GetChildren();
+        const auto child = std::ranges::find_if(children, [&name](const CItem* c)
+        {
+            return _wcsicmp(c->m_Name, name.c_str()) == 0;
+        });
+        item = child != children.end() ? *child : nullptr;
+        start = end + 1;
+    }
+    return item;
+}
+
+CItem* CItem::ApplyChange(const std::wstring& name)
+{
+    const auto& children = GetChildren();
+    const auto existing = std::ranges::find_if(children, [&name](const CItem* child)
+    {
+        return _wcsicmp(child->m_Name, name.c_str()) == 0;
+    });
+    CItem* child = existing != children.end() ? *existing : nullptr;
+
+    FileFindEnhanced finder;
+    const bool found = finder.FindFile(GetPath(), name);
+
+    // Remove entries that are gone or have been replaced by another type
+    if (child != nullptr && (!found || finder.IsDirectory() != child->IsType(IT_DIRECTORY)))
+    {
+        const auto doc = CDirStatDoc::GetDocument();
+        if (child->IsAncestorOf(doc->GetZoomItem())) doc->SetZoomItem(this);
+        CFileDupeControl::Get()->RemoveItem(child);
+        CFileTopControl::Get()->RemoveItem(child);
+
+        child->ExtensionDataRemoveChildren();
+        UpwardSubtractSizePhysical(child->GetSizePhysical());
+        UpwardSubtractSizeLogical(child->GetSizeLogical());
+        UpwardSubtractSizeExclusive(child->GetSizeExclusive());
+        UpwardSubtractFiles(child->IsType(IT_FILE) ? 1 : child->GetFilesCount());
+        UpwardSubtractFolders(child->IsType(IT_FILE) ? 0 : child->GetFoldersCount() + 1);
+        RemoveChild(child);
+        UpwardRecalcLastChange();
+        child = nullptr;
+    }
+
+    if (!found) return nullptr;
+
+    // New directories are added empty and have to be scanned by the caller;
+    // changes to existing ones are reported for the entries within them
+    if (finder.IsDirectory())
+    {
+        if (child != nullptr || IsExcludedDirectory(finder) ||
+            CReparsePoints::IsReparsePoint(finder.GetAttributes()) &&
+            !CDirStatApp::Get()->IsFollowingAllowed(finder.GetFilePathLong(), finder.GetAttributes(), finder.GetReparseTag()))
+        {
+            return nullptr;
+        }
+
+        child = new CItem(IT_DIRECTORY, finder.GetFileName());
+        child->SetLastChange(finder.GetLastWriteTime());
+        child->SetAttributes(finder.GetAttributes());
+        AddChild(child);
+        UpwardAddFolders(1);
+        return child;
+    }
+
+    // Modified files are rescanned by the caller so that their duplicates,
+    // largest files and exclusive size are updated along with their size
+    if (child != nullptr) return child;
+
+    if (IsExcludedFile(finder)) return nullptr;
+    child = new CItem(IT_FILE, finder.GetFileName(), finder.GetLastWriteTime(), finder.GetFileSizePhysical(),
+        finder.GetFileSizeLogical(), finder.GetAttributes(), 0, 0);
+    AddChild(child);
+    UpwardAddFiles(1);
+    child->ExtensionDataAdd();
+    child->SetDone();
+    CFileTopControl::Get()->ProcessTop(child);
+    return nullptr;
+}
+
 void CItem::CreateFreeSpaceItem()
 {
     ASSERT(IsType(IT_DRIVE));
@@ -1153,9 +1668,13 @@ void CItem::UpdateFreeSpaceItem()
 
     auto [total, free] = CDirStatApp::GetFreeDiskSpace(GetPath());
 
-    // Recreate name based on updated space percentage
-    m_Name = std::format(L"{:.2}|{} - {:.1f}% {}", m_Name, FormatVolumeNameOfRootPath(GetPath()),
-        100.0 * static_cast<double>(free) / static_cast<double>(total), Localization::Lookup(IDS_COL_FREE));
+    // Recreate name based on updated space percentage; the previous name is
+    // released by the user interface thread so it is not freed while drawn
+    const LPCWSTR previous = m_Name;
+    m_Name = NamePool::Intern(std::format(L"{:.2}|{} - {:.1f}% {}", GetName(), FormatVolumeNameOfRootPath(GetPath()),
+        100.0 * static_cast<double>(free) / static_cast<double>(total), Localization::Lookup(IDS_COL_FREE)));
+    if (CMainFrame::Get() != nullptr) CMainFrame::Get()->InvokeInMessageThread([previous] { NamePool::Release(previous); });
+    else NamePool::Release(previous);
 
     // Update freespace item if it exists
     CItem* freeSpaceItem = FindFreeSpaceItem();
@@ -1312,15 +1831,15 @@ std::wstring CItem::UpwardGetPathWithoutBackslash() const
     {
         if (p->IsType(IT_DIRECTORY))
         {
-            path.insert(0, p->m_Name + L"\\");
+            path.insert(0, L"\\").insert(0, p->GetName());
         }
         else if (p->IsType(IT_FILE))
         {
-            path = p->m_Name;
+            path = p->GetName();
         }
         else if (p->IsType(IT_DRIVE))
         {
-            path.insert(0, p->m_Name.substr(0, 2) + L"\\");
+            path.insert(0, L"\\").insert(0, p->GetName().substr(0, 2));
         }
     }
 
@@ -1328,50 +1847,246 @@ std::wstring CItem::UpwardGetPathWithoutBackslash() const
     return path;
 }
 
+void CItem::SCANTOTALS::Add(const CItem* item)
+{
+    if (item->IsType(IT_FILE)) m_Files++;
+    else m_Subdirs++;
+    m_SizePhysical += item->m_SizePhysical;
+    m_SizeLogical += item->m_SizeLogical;
+    if (CompareFileTime(&item->m_LastChange, &m_LastChange) == 1) m_LastChange = item->m_LastChange;
+}
+
+void CItem::UpwardPublishTotals(SCANTOTALS& totals)
+{
+    if (totals.m_Files == 0 && totals.m_Subdirs == 0) return;
+    for (auto p = this; p != nullptr; p = p->GetParent())
+    {
+        p->m_FolderInfo->m_Files += totals.m_Files;
+        p->m_FolderInfo->m_Subdirs += totals.m_Subdirs;
+        if (totals.m_SizePhysical > 0) p->m_SizePhysical += totals.m_SizePhysical;
+        if (totals.m_SizeLogical > 0) p->m_SizeLogical += totals.m_SizeLogical;
+        if (CompareFileTime(&totals.m_LastChange, &p->m_LastChange) == 1) p->m_LastChange = totals.m_LastChange;
+    }
+
+    totals = {};
+}
+
+bool CItem::IsExcludedFile(const FileFindEnhanced& finder)
+{
+    // The reparse tag is only resolved if it decides the outcome
+    const DWORD attributes = finder.GetAttributes();
+    return IsExcludedFile(finder.GetFileName(), attributes, finder.GetFileSizeLogical(),
+        COptions::ExcludeSymbolicLinksFile && CReparsePoints::IsReparsePoint(attributes) ? finder.GetReparseTag() : 0);
+}
+
+bool CItem::IsExcludedFile(const std::wstring_view name, const DWORD attributes, const ULONGLONG sizeLogical, const DWORD reparseTag)
+{
+    constexpr DWORD hiddenSystem = FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM;
+    if (COptions::ExcludeHiddenFile && (attributes & FILE_ATTRIBUTE_HIDDEN) != 0 ||
+        COptions::ExcludeProtectedFile && (attributes & hiddenSystem) == hiddenSystem ||
+        COptions::ExcludeSymbolicLinksFile && CReparsePoints::IsReparsePoint(attributes) &&
+            reparseTag == IO_REPARSE_TAG_SYMLINK)
+    {
+        return true;
+    }
+
+    // Exclude files matching name filter
+    if (!COptions::FilteringExcludeFilesMatcher.IsEmpty() &&
+        COptions::FilteringExcludeFilesMatcher.Matches(name))
+    {
+        return true;
+    }
+    if (!COptions::FilteringExcludeFilesRegex.empty() && std::ranges::any_of(COptions::FilteringExcludeFilesRegex,
+        [&name](const auto& pattern)
+        {
+            return std::regex_match(name.begin(), name.end(), pattern);
+        }))
+    {
+        return true;
+    }
+
+    // Exclude files matching size filter
+    return COptions::FilteringSizeMinimumCalculated > 0 && sizeLogical < COptions::FilteringSizeMinimumCalculated;
+}
+
+bool CItem::IsExcludedDirectory(const FileFindEnhanced& finder)
+{
+    return IsExcludedDirectory(finder.GetFilePath(), finder.GetAttributes());
+}
+
+bool CItem::IsExcludedDirectory(const std::wstring& path, const DWORD attributes)
+{
+    constexpr DWORD hiddenSystem = FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM;
+    if (COptions::ExcludeHiddenDirectory && (attributes & FILE_ATTRIBUTE_HIDDEN) != 0 ||
+        COptions::ExcludeProtectedDirectory && (attributes & hiddenSystem) == hiddenSystem)
+    {
+        return true;
+    }
+
+    // Exclude directories matching path filter; the scan matches these
+    // incrementally but a single directory is matched on its full path
+    if (!COptions::FilteringExcludeDirsMatcher.IsEmpty() && COptions::FilteringExcludeDirsMatcher.Matches(path))
+    {
+        return true;
+    }
+    return std::ranges::any_of(COptions::FilteringExcludeDirsRegex,
+        [&path](const auto& pattern) { return std::regex_match(path, pattern); });
+}
+
 CItem* CItem::AddDirectory(const FileFindEnhanced& finder)
 {
+    // Only reparse points need their full path resolved to check the target
     const bool follow = !finder.IsProtectedReparsePoint() &&
-        CDirStatApp::Get()->IsFollowingAllowed(finder.GetFilePathLong(), finder.GetAttributes());
+        (!CReparsePoints::IsReparsePoint(finder.GetAttributes()) ||
+        CDirStatApp::Get()->IsFollowingAllowed(finder.GetFilePathLong(), finder.GetAttributes(), finder.GetReparseTag()));
 
     const auto & child = new CItem(IT_DIRECTORY, finder.GetFileName());
     child->SetLastChange(finder.GetLastWriteTime());
     child->SetAttributes(finder.GetAttributes());
-    AddChild(child);
-    child->UpwardAddReadJobs(follow ? 1 : 0);
+    AddChild(child, true);
+    if (follow) child->UpwardAddPendingJob();
     return child;
 }
 
 CItem* CItem::AddFile(const FileFindEnhanced& finder)
 {
     const auto & child = new CItem(IT_FILE, finder.GetFileName());
-    child->SetSizePhysical(finder.GetFileSizePhysical());
+    if (finder.IsFileSizePhysicalKnown()) child->SetSizePhysical(finder.GetFileSizePhysical());
     child->SetSizeLogical(finder.GetFileSizeLogical());
     child->SetLastChange(finder.GetLastWriteTime());
     child->SetAttributes(finder.GetAttributes());
-    child->ExtensionDataAdd();
-    AddChild(child);
+    AddChild(child, true);
     child->SetDone();
     return child;
 }
 
-void CItem::UpwardDrivePacman()
+void CItem::PublishActiveItem(CItem* item)
+{
+    // Slots are handed out on first use and returned when the thread exits;
+    // only if more threads run than there are slots do they share one
+    using ACTIVESLOT = struct ACTIVESLOT
+    {
+        size_t m_Index = 0;
+        bool m_Owned = false;
+
+        ACTIVESLOT()
+        {
+            std::lock_guard lock(m_ActiveSlotsMutex);
+            for (; m_Index < ACTIVE_ITEM_SLOTS && m_ActiveSlotsUsed[m_Index]; m_Index++) {}
+            m_Owned = m_Index < ACTIVE_ITEM_SLOTS;
+            if (m_Owned) m_ActiveSlotsUsed[m_Index] = true;
+            else m_Index = std::hash<std::thread::id>{}(std::this_thread::get_id()) % ACTIVE_ITEM_SLOTS;
+        }
+
+        ~ACTIVESLOT()
+        {
+            if (!m_Owned) return;
+            std::lock_guard lock(m_ActiveSlotsMutex);
+            m_ActiveItems[m_Index].store(nullptr, std::memory_order_release);
+            m_ActiveSlotsUsed[m_Index] = false;
+        }
+    };
+
+    thread_local const ACTIVESLOT slot;
+    m_ActiveItems[slot.m_Index].store(item, std::memory_order_release);
+}
+
+bool CItem::RegisterFileId(const ULONGLONG volume, const FILE_ID_128& fileId)
+{
+    // File identifiers are 128-bit on ReFS and neither they nor volume
+    // serial numbers are available from all file systems
+    FILEIDKEY key{ volume, 0, 0 };
+    std::memcpy(&key.m_Low, fileId.Identifier, sizeof(key.m_Low));
+    std::memcpy(&key.m_High, fileId.Identifier + sizeof(key.m_Low), sizeof(key.m_High));
+    if (volume == 0 || key.m_Low == 0 && key.m_High == 0) return true;
+
+    auto& shard = m_FileIds[FILEIDHASH{}(key) % FILE_ID_SHARDS];
+    std::lock_guard lock(shard.m_Mutex);
+    return shard.m_Items.try_emplace(key, this).second;
+}
+
+void CItem::ClearFileIds()
+{
+    for (auto& shard : m_FileIds)
+    {
+        std::lock_guard lock(shard.m_Mutex);
+        shard.m_Items.clear();
+    }
+}
+
+void CItem::DriveActivePacman()
 {
     if (!COptions::PacmanAnimation)
     {
         return;
     }
 
-    for (auto p = this; p != nullptr; p = p->GetParent())
+    // Animate the visible ancestors of all items currently being scanned
+    std::unordered_set<const CItem*> visited;
+    for (const auto& slot : m_ActiveItems)
     {
-        if (p->IsType(IT_FILE) || !p->IsVisible()) continue;
-        if (p->GetReadJobs() == 0) p->StopPacman();
-        else p->DrivePacman();
+        for (auto p = slot.load(std::memory_order_acquire); p != nullptr && visited.insert(p).second; p = p->GetParent())
+        {
+            if (p->IsType(IT_FILE) || !p->IsVisible()) continue;
+            if (p->m_FolderInfo->m_Jobs == 0) p->StopPacman();
+            else p->DrivePacman();
+        }
     }
 }
 
+void CItem::ClearActiveItems()
+{
+    for (auto& slot : m_ActiveItems)
+    {
+        slot = nullptr;
+    }
+}
+
+void CItem::ReleaseAllocations()
+{
+    // only succeeds once every item has been deleted; the slabs are then
+    // returned in one go rather than holding on to the peak of the last scan
+    ChildList<CItem*>::Reclaim();
+    if (SlabAllocator<CItem>::ReleaseAll() && SlabAllocator<CHILDINFO>::ReleaseAll())
+    {
+        VTRACE(L"Released item allocations");
+    }
+}
+
+void CItem::GetAllocatorUsage(ULONGLONG& reserved, ULONGLONG& live)
+{
+    ULONGLONG infoReserved, infoLive;
+    SlabAllocator<CItem>::GetUsage(reserved, live);
+    SlabAllocator<CHILDINFO>::GetUsage(infoReserved, infoLive);
+    reserved += infoReserved;
+    live += infoLive;
+
+    // chunks are freed with their last name so all of the pool is counted as in use
+    const ULONGLONG names = NamePool::GetReserved();
+    reserved += names;
+    live += names;
+}
+
 std::shared_mutex CItem::m_HashMutex;
+std::atomic<ULONG> CItem::m_ReadJobsEpoch = 0;
+std::array<std::atomic<CItem*>, CItem::ACTIVE_ITEM_SLOTS> CItem::m_ActiveItems;
+std::array<CItem::FILEIDSHARD, CItem::FILE_ID_SHARDS> CItem::m_FileIds;
+std::array<CItem::EXCLUSIVESHARD, CItem::EXCLUSIVE_SHARDS> CItem::m_FileSizesExclusive;
+std::atomic<size_t> CItem::m_FileSizesExclusiveCount = 0;
+std::mutex CItem::m_ResizedMutex;
+std::unordered_set<CItem*> CItem::m_ResizedFolders;
+std::mutex CItem::m_ActiveSlotsMutex;
+std::bitset<CItem::ACTIVE_ITEM_SLOTS> CItem::m_ActiveSlotsUsed;
 BCRYPT_ALG_HANDLE CItem::m_HashAlgHandle = nullptr;
 DWORD CItem::m_HashLength = 0;
+RateLimiter CItem::m_FolderLimiter;
+RateLimiter CItem::m_HashLimiter;
+
+void CItem::SetScanLimits(const double foldersPerSecond, const double hashBytesPerSecond)
+{
+    m_FolderLimiter.SetRate(foldersPerSecond);
+    m_HashLimiter.SetRate(hashBytesPerSecond);
+}
 
 std::vector<BYTE> CItem::GetFileHash(ULONGLONG hashSizeLimit, BlockingQueue<CItem*>* queue)
 {
@@ -1412,20 +2127,24 @@ std::vector<BYTE> CItem::GetFileHash(ULONGLONG hashSizeLimit, BlockingQueue<CIte
     DWORD iReadResult = 0;
     DWORD iHashResult = 0;
     DWORD iReadBytes = 0;
-    while ((iReadResult = ReadFile(hFile, FileBuffer.data(), static_cast<DWORD>(
-        hashSizeLimit > 0 ? min(hashSizeLimit, FileBuffer.size()) : FileBuffer.size()),
-        &iReadBytes, nullptr)) != 0 && iReadBytes > 0)
+    bool cancelled = false;
+    const auto readSize = static_cast<DWORD>(hashSizeLimit > 0 ? min(hashSizeLimit, FileBuffer.size()) : FileBuffer.size());
+    while (true)
     {
-        UpwardDrivePacman();
+        cancelled = !queue->Throttle(m_HashLimiter, readSize);
+        if (cancelled) break;
+        iReadResult = ReadFile(hFile, FileBuffer.data(), readSize, &iReadBytes, nullptr);
+        if (iReadResult == 0 || iReadBytes == 0) break;
+
         iHashResult = BCryptHashData(HashHandle, FileBuffer.data(), iReadBytes, 0);
         if (iHashResult != 0 || hashSizeLimit > 0) break;
-        queue->WaitIfSuspended();
     }
 
-    // Complete hash data
+    // Complete hash data; this also resets the reusable handle if the
+    // hash was abandoned so the next file does not start from a partial state
     Hash.resize(m_HashLength);
-    if (iHashResult != 0 || iReadResult == 0 ||
-        BCryptFinishHash(HashHandle, Hash.data(), m_HashLength, 0) != 0)
+    const bool finished = BCryptFinishHash(HashHandle, Hash.data(), m_HashLength, 0) == 0;
+    if (!finished || cancelled || iHashResult != 0 || iReadResult == 0)
     {
         return {};
     }
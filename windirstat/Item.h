@@ -25,8 +25,16 @@
 #include "DirStatDoc.h" // CExtensionData
 #include "FileFind.h" // FileFindEnhanced
 #include "BlockingQueue.h"
+#include "RateLimiter.h"
+#include "SlabAllocator.h"
+#include "NamePool.h"
+#include "ChildList.h"
 
 #include <shared_mutex>
+#include <array>
+#include <unordered_map>
+#include <unordered_set>
+#include <bitset>
 
 // Columns
 enum ITEMCOLUMNS : std::uint8_t
@@ -42,7 +50,8 @@ enum ITEMCOLUMNS : std::uint8_t
     COL_FOLDERS,
     COL_LASTCHANGE,
     COL_ATTRIBUTES,
-    COL_OWNER
+    COL_OWNER,
+    COL_SIZE_EXCLUSIVE
 };
 
 // Item types
@@ -60,6 +69,7 @@ enum ITEMTYPE : unsigned short
     ITF_SKIPHASH  = 1 << 10, // Indicates cannot be hased (unreadable)
     ITF_PARTHASH  = 1 << 11, // Indicates a partial hash
     ITF_FULLHASH  = 1 << 12, // Indicates a full hash
+    ITF_HARDLINK  = 1 << 13, // Indicates another link to a file already counted
     ITF_FLAGS     = 0xFF00,  // All potential flag items
 };
 
@@ -110,11 +120,23 @@ public:
     CItem(CItem&&) = delete;
     CItem& operator=(const CItem&) = delete;
     CItem& operator=(CItem&&) = delete;
-    CItem(ITEMTYPE type, const std::wstring& name);
-    CItem(ITEMTYPE type, const std::wstring& name, FILETIME lastChange, ULONGLONG sizePhysical,
+    CItem(ITEMTYPE type, std::wstring_view name);
+    CItem(ITEMTYPE type, std::wstring_view name, FILETIME lastChange, ULONGLONG sizePhysical,
         ULONGLONG sizeLogical, DWORD attributes, ULONG files, ULONG subdirs);
     ~CItem() override;
 
+    // Items are carved from per-thread slabs instead of the heap
+    static void* operator new(const size_t size)
+    {
+        ASSERT(size == sizeof(CItem));
+        return SlabAllocator<CItem>::Allocate();
+    }
+
+    static void operator delete(void* item)
+    {
+        SlabAllocator<CItem>::Deallocate(item);
+    }
+
     // CTreeListItem Interface
     bool DrawSubItem(int subitem, CDC* pdc, CRect rc, UINT state, int* width, int* focusLeft) override;
     std::wstring GetText(int subitem) const override;
@@ -142,12 +164,12 @@ public:
     int TmiGetChildCount() const override
     {
         if (!m_FolderInfo) return 0;
-        return static_cast<int>(m_FolderInfo->m_Children.size());
+        return static_cast<int>(GetChildren().size());
     }
 
     Item* TmiGetChild(const int c) const override
     {
-        return m_FolderInfo->m_Children[c];
+        return GetChildren()[c];
     }
 
     ULONGLONG TmiGetSize() const override
@@ -162,7 +184,7 @@ public:
     ULONGLONG GetProgressRange() const;
     ULONGLONG GetProgressPos() const;
     void UpdateStatsFromDisk();
-    const std::vector<CItem*>& GetChildren() const;
+    ChildList<CItem*>::View GetChildren() const;
     CItem* GetParent() const;
     void AddChild(CItem* child, bool addOnly = false);
     void RemoveChild(CItem* child);
@@ -175,8 +197,10 @@ public:
     void UpwardSubtractSizePhysical(ULONGLONG bytes);
     void UpwardAddSizeLogical(ULONGLONG bytes);
     void UpwardSubtractSizeLogical(ULONGLONG bytes);
-    void UpwardAddReadJobs(ULONG count);
-    void UpwardSubtractReadJobs(ULONG count);
+    void UpwardAddSizeExclusive(ULONGLONG bytes);
+    void UpwardSubtractSizeExclusive(ULONGLONG bytes);
+    void UpwardAddPendingJob();
+    void UpwardCompletePendingJob();
     void UpwardUpdateLastChange(const FILETIME& t);
     void UpwardRecalcLastChange(bool withoutItem = false);
     void ExtensionDataAdd() const;
@@ -184,9 +208,17 @@ public:
     void ExtensionDataRemoveChildren() const;
     ULONGLONG GetSizePhysical() const;
     ULONGLONG GetSizeLogical() const;
+    ULONGLONG GetSizeExclusive() const;
     void SetSizePhysical(ULONGLONG size);
     void SetSizeLogical(ULONGLONG size);
     ULONG GetReadJobs() const;
+    static void ResampleReadJobs();
+    static void DriveActivePacman();
+    static void ClearActiveItems();
+    static void ClearFileIds();
+    static void ReleaseAllocations();
+    static void GetAllocatorUsage(ULONGLONG& reserved, ULONGLONG& live);
+    static void SetScanLimits(double foldersPerSecond, double hashBytesPerSecond);
     FILETIME GetLastChange() const;
     void SetLastChange(const FILETIME& t);
     void SetAttributes(DWORD attr);
@@ -199,7 +231,7 @@ public:
     std::wstring GetOwner(bool force = false) const;
     bool HasUncPath() const;
     std::wstring GetFolderPath() const;
-    std::wstring GetName() const;
+    std::wstring_view GetName() const;
     std::wstring GetExtension() const;
     ULONG GetFilesCount() const;
     ULONG GetFoldersCount() const;
@@ -208,11 +240,16 @@ public:
     void SortItemsBySizePhysical() const;
     ULONGLONG GetTicksWorked() const;
     void ResetScanStartTime() const;
-    static void ScanItems(BlockingQueue<CItem*> *);
+    static void ScanItems(BlockingQueue<CItem*> *, BlockingQueue<CItem*> * sizeQueue, BlockingQueue<CItem*> * extentQueue);
+    static void ScanItemsPhysicalSize(BlockingQueue<CItem*> *, BlockingQueue<CItem*> * extentQueue);
+    static void ScanItemsExtents(BlockingQueue<CItem*> *);
+    static void ScanItemsResort();
     static void ScanItemsFinalize(CItem* item);
     void UpwardSetDone();
     void UpwardSetUndone();
     CItem* FindRecyclerItem() const;
+    CItem* FindItemByPath(const std::wstring& path);
+    CItem* ApplyChange(const std::wstring& name);
     void CreateFreeSpaceItem();
     CItem* FindFreeSpaceItem() const;
     void UpdateFreeSpaceItem();
@@ -251,37 +288,132 @@ public:
     }
 
 private:
+    // Totals gathered while enumerating a directory so that they can be
+    // published to the ancestors in one pass instead of once per entry
+    using SCANTOTALS = struct SCANTOTALS
+    {
+        ULONGLONG m_SizePhysical = 0;
+        ULONGLONG m_SizeLogical = 0;
+        FILETIME m_LastChange = { 0, 0 };
+        ULONG m_Files = 0;
+        ULONG m_Subdirs = 0;
+        ULONG m_Entries = 0;
+
+        void Add(const CItem* item);
+    };
+
     ULONGLONG GetProgressRangeMyComputer() const;
     ULONGLONG GetProgressRangeDrive() const;
     COLORREF GetGraphColor() const;
     bool MustShowReadJobs() const;
     COLORREF GetPercentageColor() const;
     std::wstring UpwardGetPathWithoutBackslash() const;
+    static bool IsExcludedFile(const FileFindEnhanced& finder);
+    static bool IsExcludedFile(std::wstring_view name, DWORD attributes, ULONGLONG sizeLogical, DWORD reparseTag);
+    static bool IsExcludedDirectory(const FileFindEnhanced& finder);
+    static bool IsExcludedDirectory(const std::wstring& path, DWORD attributes);
+    bool ScanMasterFileTable(BlockingQueue<CItem*>* queue, BlockingQueue<CItem*>* extentQueue);
     CItem* AddDirectory(const FileFindEnhanced& finder);
     CItem* AddFile(const FileFindEnhanced& finder);
-    void UpwardDrivePacman();
+    void UpwardPublishTotals(SCANTOTALS& totals);
+    static void PublishActiveItem(CItem* item);
+    bool RegisterFileId(ULONGLONG volume, const FILE_ID_128& fileId);
 
     // Used for initialization of hashing process
     static std::shared_mutex m_HashMutex;
+
+    // Incremented by the user interface to invalidate sampled read job counts
+    static std::atomic<ULONG> m_ReadJobsEpoch;
+
+    // Items being scanned as published by the scanning threads; these are
+    // sampled by the user interface to animate the pacman of their ancestors.
+    // Each thread holds a slot of its own while it runs; there are enough
+    // for the largest thread budget on several volumes at once
+    static constexpr size_t ACTIVE_ITEM_SLOTS = 256;
+    static std::array<std::atomic<CItem*>, ACTIVE_ITEM_SLOTS> m_ActiveItems;
+    static std::mutex m_ActiveSlotsMutex;
+    static std::bitset<ACTIVE_ITEM_SLOTS> m_ActiveSlotsUsed;
+
+    // Files seen during the scan by file identifier so that additional hard
+    // links are only counted once; sharded to limit contention between threads
+    using FILEIDKEY = struct FILEIDKEY
+    {
+        ULONGLONG m_Volume;
+        ULONGLONG m_Low;
+        ULONGLONG m_High;
+        bool operator==(const FILEIDKEY&) const = default;
+    };
+    using FILEIDHASH = struct FILEIDHASH
+    {
+        size_t operator()(const FILEIDKEY& key) const noexcept
+        {
+            return std::hash<ULONGLONG>{}(key.m_Low) ^ std::hash<ULONGLONG>{}(key.m_High) * 31 ^
+                std::hash<ULONGLONG>{}(key.m_Volume);
+        }
+    };
+    using FILEIDSHARD = struct FILEIDSHARD
+    {
+        std::mutex m_Mutex;
+        std::unordered_map<FILEIDKEY, CItem*, FILEIDHASH> m_Items;
+    };
+    static constexpr size_t FILE_ID_SHARDS = 64;
+    static std::array<FILEIDSHARD, FILE_ID_SHARDS> m_FileIds;
+
+    // Exclusive sizes of files are only known once their extents have been
+    // mapped so they are kept aside rather than in every item; sharded by item
+    using EXCLUSIVESHARD = struct EXCLUSIVESHARD
+    {
+        std::mutex m_Mutex;
+        std::unordered_map<const CItem*, ULONGLONG> m_Sizes;
+    };
+    static constexpr size_t EXCLUSIVE_SHARDS = 64;
+    static std::array<EXCLUSIVESHARD, EXCLUSIVE_SHARDS> m_FileSizesExclusive;
+    static std::atomic<size_t> m_FileSizesExclusiveCount;
+    EXCLUSIVESHARD& GetExclusiveShard() const;
+
+    // Folders with a file whose physical size was resolved after the folder
+    // may have been sorted; these are sorted again once all sizes are known
+    static std::mutex m_ResizedMutex;
+    static std::unordered_set<CItem*> m_ResizedFolders;
+
     static BCRYPT_ALG_HANDLE m_HashAlgHandle;
     static DWORD m_HashLength;
 
+    // Limits on the folders enumerated and the bytes hashed per second
+    // shared by all scanning threads to reduce the load on busy servers
+    static RateLimiter m_FolderLimiter;
+    static RateLimiter m_HashLimiter;
+
     // Special structure for container items that is separately allocated to
     // reduce memory usage.  This operates under the assumption that most
     // containers have files in them.
     using CHILDINFO = struct CHILDINFO
     {
-        std::vector<CItem*> m_Children;
-        std::shared_mutex m_Protect;
+        ChildList<CItem*> m_Children;     // Written only by the thread scanning or changing this node
         std::atomic<ULONG> m_Tstart = 0;  // initial time this node started enumerating
         std::atomic<ULONG> m_Tfinish = 0; // initial time this node started enumerating
         std::atomic<ULONG> m_Files = 0;   // # Files in subtree
         std::atomic<ULONG> m_Subdirs = 0; // # Folder in subtree
-        std::atomic<ULONG> m_Jobs = 0;    // # "read jobs" in subtree.
+        std::atomic<ULONG> m_Jobs = 0;    // # pending scan of self plus direct children with pending jobs
+        std::atomic<ULONGLONG> m_SizeExclusive = 0; // Physical size of subtree not shared with other files
+        ULONG m_JobsSample = 0;           // # "read jobs" in subtree as last counted by the user interface
+        ULONG m_JobsSampleEpoch = ULONG_MAX; // Epoch at which the sample was taken
+        FileFindBackend::Handle m_ParentHandle; // Parent directory handle held until this node is enumerated
+
+        static void* operator new(const size_t size)
+        {
+            ASSERT(size == sizeof(CHILDINFO));
+            return SlabAllocator<CHILDINFO>::Allocate();
+        }
+
+        static void operator delete(void* info)
+        {
+            SlabAllocator<CHILDINFO>::Deallocate(info);
+        }
     };
 
-    RECT m_Rect;                                  // To support TreeMapView
-    std::wstring m_Name;                          // Display name
+    SMALL_RECT m_Rect = {};                       // To support TreeMapView; bounded by the view so 16-bit
+    LPCWSTR m_Name;                               // Display name held in the name pool
     FILETIME m_LastChange = {0, 0};               // Last modification time of self or subtree
     std::unique_ptr<CHILDINFO> m_FolderInfo;      // Child information for non-files
     std::atomic<ULONGLONG> m_SizePhysical = 0;    // Total physical size of self or subtree
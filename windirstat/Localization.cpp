@@ -83,7 +83,7 @@ std::vector<LANGID> Localization::GetLanguageList()
     FileFindEnhanced finder;
     for (BOOL b = finder.FindFile(GetAppFolder(), L"lang_??.txt"); b; b = finder.FindNextFile())
     {
-        const std::wstring lang = finder.GetFileName().substr(5, 2);
+        const std::wstring lang(finder.GetFileName().substr(5, 2));
         const LCID lcid = LocaleNameToLCID(lang.c_str(), LOCALE_ALLOW_NEUTRAL_NAMES);
         if (lcid == LOCALE_NEUTRAL || lcid == LOCALE_CUSTOM_UNSPECIFIED) continue;
 
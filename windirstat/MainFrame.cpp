@@ -514,7 +514,8 @@ void CMainFrame::UpdateProgress()
 
     if (m_ProgressRange > 0 && m_Progress.m_hWnd != nullptr)
     {
-        // Limit progress at 100% as hard-linked files will count twice
+        // Limit progress at 100% as hard links are only matched within a scan
+        // and may still count twice when only part of a volume is refreshed
         const int pos = min(static_cast<int>((m_ProgressPos * 100ull) / m_ProgressRange), 100);
         m_Progress.SetPos(pos);
 
@@ -826,9 +827,21 @@ void CMainFrame::OnTimer(const UINT_PTR nIDEvent)
     // UI updates that do need to processed frequently
     if (!CDirStatDoc::GetDocument()->IsRootDone() && !IsScanSuspended())
     {
+        // Recount read jobs on demand for the items about to be redrawn
+        CItem::ResampleReadJobs();
+
+        // Animate pacman for the directories the scanner is working on
+        CItem::DriveActivePacman();
+
         // Update the visual progress on the bottom of the screen
         UpdateProgress();
 
+        // Scan what the user navigated to ahead of everything else
+        if (doInfrequentUpdate) CDirStatDoc::GetDocument()->UpdateScanFocus();
+
+        // Shift workers to the volumes that benefit from them most
+        if (doInfrequentUpdate) CDirStatDoc::GetDocument()->BalanceScanThreads();
+
         // By sorting items, items will be redrawn which will
         // also force pacman to update with recent position
         CFileTreeControl::Get()->SortItems();
@@ -845,6 +858,16 @@ void CMainFrame::OnTimer(const UINT_PTR nIDEvent)
             CFileTopControl::Get()->SortItems();
         }
     }
+    else if (COptions::WatchForChanges)
+    {
+        // Apply changes made to the scanned folders once they have settled
+        CDirStatDoc::GetDocument()->ApplyWatchedChanges();
+    }
+    else
+    {
+        // Release the watched folders as soon as watching is switched off
+        CDirStatDoc::GetDocument()->StopWatchingChanges();
+    }
 
     CFrameWndEx::OnTimer(nIDEvent);
 }
@@ -1072,6 +1095,12 @@ void CMainFrame::UpdatePaneText()
         fileSelectionText = hover;
     }
 
+    // Show the workers used per volume while scanning
+    else if (const std::wstring & threads = CDirStatDoc::GetDocument()->GetScanThreadsText(); !threads.empty())
+    {
+        fileSelectionText = threads;
+    }
+
     // Only get the data the document is not actively updating
     else if (CDirStatDoc::GetDocument()->IsRootDone())
     {
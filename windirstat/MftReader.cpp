@@ -0,0 +1,451 @@
+﻿// MftReader.cpp - Implementation of MftReader
+//
+// WinDirStat - Directory Statistics
+// Copyright © WinDirStat Team
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+
+#include "stdafx.h"
+
+#include "MftReader.h"
+
+#include <array>
+#include <thread>
+
+namespace
+{
+#pragma pack(push, 1)
+    using BOOTSECTOR = struct BOOTSECTOR
+    {
+        BYTE Jump[3];
+        char OemId[8];
+        WORD BytesPerSector;
+        BYTE SectorsPerCluster;
+        BYTE Reserved1[7];
+        BYTE MediaDescriptor;
+        BYTE Reserved2[18];
+        ULONGLONG TotalSectors;
+        ULONGLONG MftCluster;
+        ULONGLONG MftMirrorCluster;
+        signed char ClustersPerRecord;
+    };
+
+    using FILERECORD = struct FILERECORD
+    {
+        DWORD Magic;
+        WORD UpdateSequenceOffset;
+        WORD UpdateSequenceCount;
+        ULONGLONG LogSequenceNumber;
+        WORD SequenceNumber;
+        WORD LinkCount;
+        WORD FirstAttributeOffset;
+        WORD Flags;
+        DWORD BytesInUse;
+        DWORD BytesAllocated;
+        ULONGLONG BaseRecord;
+    };
+
+    using ATTRIBUTE = struct ATTRIBUTE
+    {
+        DWORD Type;
+        DWORD Length;
+        BYTE IsNonResident;
+        BYTE NameLength;
+        WORD NameOffset;
+        WORD Flags;
+        WORD Id;
+        union
+        {
+            struct
+            {
+                DWORD ValueLength;
+                WORD ValueOffset;
+            } Resident;
+            struct
+            {
+                ULONGLONG StartingVcn;
+                ULONGLONG LastVcn;
+                WORD RunsOffset;
+                WORD CompressionUnit;
+                DWORD Padding;
+                ULONGLONG AllocatedSize;
+                ULONGLONG DataSize;
+                ULONGLONG InitializedSize;
+                ULONGLONG CompressedSize; // only present for compressed and sparse data
+            } NonResident;
+        };
+    };
+
+    using STANDARDINFORMATION = struct STANDARDINFORMATION
+    {
+        FILETIME CreationTime;
+        FILETIME LastWriteTime;
+        FILETIME ChangeTime;
+        FILETIME LastAccessTime;
+        DWORD FileAttributes;
+    };
+
+    using FILENAME = struct FILENAME
+    {
+        ULONGLONG ParentDirectory;
+        FILETIME CreationTime;
+        FILETIME LastWriteTime;
+        FILETIME ChangeTime;
+        FILETIME LastAccessTime;
+        ULONGLONG AllocatedSize;
+        ULONGLONG DataSize;
+        DWORD FileAttributes;
+        DWORD ReparseTag;
+        BYTE NameLength;
+        BYTE NameSpace;
+        WCHAR Name[1];
+    };
+#pragma pack(pop)
+
+    constexpr DWORD FILE_RECORD_MAGIC = 0x454C4946; // FILE
+    constexpr WORD RECORD_IN_USE = 0x0001;
+    constexpr WORD RECORD_DIRECTORY = 0x0002;
+    constexpr ULONGLONG RECORD_NUMBER_MASK = 0x0000FFFFFFFFFFFF; // the upper bits hold the sequence number
+    constexpr ULONG FIXUP_STRIDE = 512;
+
+    constexpr DWORD ATTRIBUTE_STANDARD_INFORMATION = 0x10;
+    constexpr DWORD ATTRIBUTE_FILE_NAME = 0x30;
+    constexpr DWORD ATTRIBUTE_DATA = 0x80;
+    constexpr DWORD ATTRIBUTE_END = 0xFFFFFFFF;
+    constexpr WORD ATTRIBUTE_COMPRESSED = 0x0001;
+    constexpr WORD ATTRIBUTE_SPARSE = 0x8000;
+    constexpr ULONG RESIDENT_HEADER_SIZE = offsetof(ATTRIBUTE, Resident) + sizeof(ATTRIBUTE::Resident);
+    constexpr ULONG NONRESIDENT_HEADER_SIZE = offsetof(ATTRIBUTE, NonResident.CompressedSize);
+    constexpr ULONG COMPRESSED_HEADER_SIZE = sizeof(ATTRIBUTE);
+
+    constexpr BYTE NAMESPACE_DOS = 2;              // short names duplicating a long name
+    constexpr DWORD INTERNAL_ATTRIBUTES = 0x30000000; // index flags not reported by the file system
+
+    // Returns the resident value of the attribute if it is fully contained in the record
+    const BYTE* GetResidentValue(const ATTRIBUTE& attribute, const ULONG minimumLength)
+    {
+        if (attribute.IsNonResident != 0 || attribute.Length < RESIDENT_HEADER_SIZE ||
+            attribute.Resident.ValueLength < minimumLength ||
+            static_cast<ULONGLONG>(attribute.Resident.ValueOffset) + attribute.Resident.ValueLength > attribute.Length)
+        {
+            return nullptr;
+        }
+        return reinterpret_cast<const BYTE*>(&attribute) + attribute.Resident.ValueOffset;
+    }
+
+    // Calls the visitor for each attribute that lies within the record
+    template <typename Visitor>
+    void ForEachAttribute(const BYTE* record, const ULONG recordSize, Visitor visitor)
+    {
+        const auto& header = *reinterpret_cast<const FILERECORD*>(record);
+        const BYTE* end = record + min(header.BytesInUse, recordSize);
+        for (const BYTE* position = record + header.FirstAttributeOffset; position + 2 * sizeof(DWORD) <= end;)
+        {
+            const auto& attribute = *reinterpret_cast<const ATTRIBUTE*>(position);
+            if (attribute.Type == ATTRIBUTE_END || attribute.Length < RESIDENT_HEADER_SIZE ||
+                attribute.Length > static_cast<ULONG>(end - position))
+            {
+                break;
+            }
+            visitor(attribute);
+            position += attribute.Length;
+        }
+    }
+}
+
+bool MftReader::Open(const std::wstring& path)
+{
+    m_File = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (m_File == INVALID_HANDLE_VALUE)
+    {
+        m_File.Release();
+        return false;
+    }
+
+    // Volume devices only accept reads aligned to their sectors
+    std::vector<BYTE> boot(4096);
+    if (!ReadAt(0, boot.data(), static_cast<ULONG>(boot.size()))) return false;
+    const auto& bootSector = *reinterpret_cast<const BOOTSECTOR*>(boot.data());
+    if (memcmp(bootSector.OemId, "NTFS    ", sizeof(bootSector.OemId)) != 0 ||
+        bootSector.BytesPerSector == 0 || bootSector.SectorsPerCluster == 0)
+    {
+        return false;
+    }
+
+    // Large values are stored as negative powers of two
+    const ULONG sectorsPerCluster = bootSector.SectorsPerCluster <= 0x80 ?
+        bootSector.SectorsPerCluster : 1ul << (256 - bootSector.SectorsPerCluster);
+    m_ClusterSize = static_cast<ULONGLONG>(bootSector.BytesPerSector) * sectorsPerCluster;
+    m_RecordSize = bootSector.ClustersPerRecord > 0 ?
+        static_cast<ULONG>(bootSector.ClustersPerRecord * m_ClusterSize) : 1ul << -bootSector.ClustersPerRecord;
+    if (m_RecordSize < sizeof(FILERECORD) || m_RecordSize > CHUNK_SIZE || CHUNK_SIZE % m_RecordSize != 0)
+    {
+        return false;
+    }
+
+    // The first record describes the table itself; its data attribute holds
+    // the runs where the table is stored on the volume
+    std::vector<BYTE> record(max(m_RecordSize, static_cast<ULONG>(bootSector.BytesPerSector)));
+    if (!ReadAt(bootSector.MftCluster * m_ClusterSize, record.data(), static_cast<ULONG>(record.size())) ||
+        reinterpret_cast<const FILERECORD*>(record.data())->Magic != FILE_RECORD_MAGIC ||
+        !ApplyFixups(record.data(), m_RecordSize))
+    {
+        return false;
+    }
+
+    m_Extents.clear();
+    ULONGLONG tableSize = 0;
+    ForEachAttribute(record.data(), m_RecordSize, [&](const ATTRIBUTE& attribute)
+    {
+        if (attribute.Type != ATTRIBUTE_DATA || attribute.NameLength != 0 || attribute.IsNonResident == 0 ||
+            attribute.Length < NONRESIDENT_HEADER_SIZE || attribute.NonResident.StartingVcn != 0 ||
+            attribute.NonResident.RunsOffset >= attribute.Length)
+        {
+            return;
+        }
+
+        const auto data = reinterpret_cast<const BYTE*>(&attribute);
+        if (DecodeRuns(data + attribute.NonResident.RunsOffset, data + attribute.Length, m_ClusterSize, m_Extents))
+        {
+            tableSize = attribute.NonResident.DataSize;
+        }
+    });
+
+    m_RecordCount = static_cast<ULONG>(min(tableSize / m_RecordSize, static_cast<ULONGLONG>(ULONG_MAX)));
+    return m_RecordCount > MftReader::FIRST_USER_RECORD;
+}
+
+bool MftReader::Read(std::vector<MFTRECORD>& records, std::vector<MFTLINK>& links, const ULONG threads, const std::stop_token stop)
+{
+    records.assign(m_RecordCount, {});
+    links.clear();
+
+    // Alternate between two buffers so the next chunk is read from the
+    // volume while the workers are still parsing the previous one
+    const ULONG recordsPerChunk = CHUNK_SIZE / m_RecordSize;
+    std::array<std::vector<BYTE>, 2> buffers = { std::vector<BYTE>(CHUNK_SIZE), std::vector<BYTE>(CHUNK_SIZE) };
+    std::vector<std::thread> workers;
+    std::vector<SLICERESULT> results;
+    const auto joinWorkers = [&workers]
+    {
+        for (auto& worker : workers) worker.join();
+        workers.clear();
+    };
+
+    bool success = true;
+    for (ULONG first = 0, chunk = 0; first < m_RecordCount; first += recordsPerChunk, ++chunk)
+    {
+        const ULONG count = min(recordsPerChunk, m_RecordCount - first);
+        BYTE* buffer = buffers[chunk % buffers.size()].data();
+        success = !stop.stop_requested() && ReadRecords(static_cast<ULONGLONG>(first) * m_RecordSize, buffer, count * m_RecordSize);
+        joinWorkers();
+        if (!success) break;
+
+        // Each slice writes only to the slots of its own records
+        const ULONG slices = max<ULONG>(1, min(threads, count));
+        const size_t resultBase = results.size();
+        results.resize(resultBase + slices);
+        for (ULONG slice = 0; slice < slices; ++slice)
+        {
+            const ULONG begin = static_cast<ULONG>(static_cast<ULONGLONG>(count) * slice / slices);
+            const ULONG end = static_cast<ULONG>(static_cast<ULONGLONG>(count) * (slice + 1) / slices);
+            workers.emplace_back([this, buffer, first, begin, end, &records, &result = results[resultBase + slice]]
+            {
+                ParseSlice(buffer + static_cast<size_t>(begin) * m_RecordSize, first + begin, end - begin, records, result);
+            });
+        }
+    }
+    joinWorkers();
+    if (!success) return false;
+
+    // Merge what was found in extension records into their base records
+    for (auto& result : results)
+    {
+        for (const auto& [base, extension] : result.m_Extensions)
+        {
+            if (base >= records.size() || !records[base].m_InUse) continue;
+            records[base].m_SizeLogical = extension.m_SizeLogical;
+            records[base].m_SizePhysical = extension.m_SizePhysical;
+        }
+        links.insert(links.end(), std::make_move_iterator(result.m_Links.begin()), std::make_move_iterator(result.m_Links.end()));
+        result = {};
+    }
+    return true;
+}
+
+void MftReader::ParseSlice(BYTE* data, const ULONG first, const ULONG count,
+    std::vector<MFTRECORD>& records, SLICERESULT& result) const
+{
+    for (ULONG index = 0; index < count; ++index)
+    {
+        BYTE* raw = data + static_cast<size_t>(index) * m_RecordSize;
+        const auto& header = *reinterpret_cast<const FILERECORD*>(raw);
+        if (header.Magic != FILE_RECORD_MAGIC || (header.Flags & RECORD_IN_USE) == 0 ||
+            header.FirstAttributeOffset >= m_RecordSize || !ApplyFixups(raw, m_RecordSize))
+        {
+            continue;
+        }
+
+        // Attributes that do not fit into the base record are stored in
+        // extension records which refer back to their base record
+        const ULONG number = first + index;
+        const ULONG base = header.BaseRecord == 0 ? number : static_cast<ULONG>(header.BaseRecord & RECORD_NUMBER_MASK);
+        MFTRECORD extension;
+        MFTRECORD& record = base == number ? records[number] : extension;
+        bool hasData = false;
+        if (base == number)
+        {
+            record.m_InUse = true;
+            if ((header.Flags & RECORD_DIRECTORY) != 0) record.m_Attributes |= FILE_ATTRIBUTE_DIRECTORY;
+        }
+
+        ForEachAttribute(raw, m_RecordSize, [&](const ATTRIBUTE& attribute)
+        {
+            if (attribute.Type == ATTRIBUTE_STANDARD_INFORMATION)
+            {
+                const auto value = GetResidentValue(attribute, sizeof(STANDARDINFORMATION));
+                if (value == nullptr) return;
+                const auto& information = *reinterpret_cast<const STANDARDINFORMATION*>(value);
+                record.m_LastWrite = information.LastWriteTime;
+                record.m_Attributes |= information.FileAttributes & ~INTERNAL_ATTRIBUTES;
+            }
+            else if (attribute.Type == ATTRIBUTE_FILE_NAME)
+            {
+                const auto value = GetResidentValue(attribute, offsetof(FILENAME, Name));
+                if (value == nullptr) return;
+                const auto& name = *reinterpret_cast<const FILENAME*>(value);
+                if (name.NameSpace == NAMESPACE_DOS ||
+                    offsetof(FILENAME, Name) + name.NameLength * sizeof(WCHAR) > attribute.Resident.ValueLength)
+                {
+                    return;
+                }
+
+                // The tag is kept with the name so it is known without reading the reparse point
+                if ((name.FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0) record.m_ReparseTag = name.ReparseTag;
+                result.m_Links.push_back({ base, static_cast<ULONG>(name.ParentDirectory & RECORD_NUMBER_MASK),
+                    std::wstring(name.Name, name.NameLength) });
+            }
+            else if (attribute.Type == ATTRIBUTE_DATA && attribute.NameLength == 0)
+            {
+                // Alternate streams are not part of the size reported for a file
+                if (attribute.IsNonResident == 0)
+                {
+                    if (GetResidentValue(attribute, 0) == nullptr) return;
+                    record.m_SizeLogical = attribute.Resident.ValueLength;
+                    record.m_SizePhysical = 0;
+                    hasData = true;
+                }
+                else if (attribute.Length >= NONRESIDENT_HEADER_SIZE && attribute.NonResident.StartingVcn == 0)
+                {
+                    const bool compressed = (attribute.Flags & (ATTRIBUTE_COMPRESSED | ATTRIBUTE_SPARSE)) != 0 &&
+                        attribute.Length >= COMPRESSED_HEADER_SIZE;
+                    record.m_SizeLogical = attribute.NonResident.DataSize;
+                    record.m_SizePhysical = compressed ? attribute.NonResident.CompressedSize : attribute.NonResident.AllocatedSize;
+                    hasData = true;
+                }
+            }
+        });
+
+        if (base != number && hasData) result.m_Extensions.emplace_back(base, extension);
+    }
+}
+
+bool MftReader::ReadRecords(ULONGLONG position, BYTE* buffer, ULONG size)
+{
+    // The table may be fragmented so a chunk can span several extents
+    for (const auto& extent : m_Extents)
+    {
+        if (size == 0) break;
+        if (position >= extent.m_Length)
+        {
+            position -= extent.m_Length;
+            continue;
+        }
+
+        const ULONG part = static_cast<ULONG>(min(static_cast<ULONGLONG>(size), extent.m_Length - position));
+        if (!ReadAt(extent.m_Offset + position, buffer, part)) return false;
+        buffer += part;
+        size -= part;
+        position = 0;
+    }
+    return size == 0;
+}
+
+bool MftReader::ReadAt(const ULONGLONG offset, BYTE* buffer, const ULONG size)
+{
+    OVERLAPPED overlapped = {};
+    overlapped.Offset = static_cast<DWORD>(offset);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+    DWORD read = 0;
+    return ReadFile(m_File, buffer, size, &read, &overlapped) != 0 && read == size;
+}
+
+bool MftReader::ApplyFixups(BYTE* record, const ULONG recordSize)
+{
+    // The last two bytes of every sector were replaced by a sequence number
+    // when written to detect torn writes; the original bytes follow the
+    // sequence number in the update sequence array
+    const auto& header = *reinterpret_cast<const FILERECORD*>(record);
+    if (header.UpdateSequenceCount < 2 ||
+        header.UpdateSequenceOffset + header.UpdateSequenceCount * sizeof(WORD) > recordSize ||
+        (header.UpdateSequenceCount - 1ul) * FIXUP_STRIDE > recordSize)
+    {
+        return false;
+    }
+
+    const auto sequence = reinterpret_cast<const WORD*>(record + header.UpdateSequenceOffset);
+    for (ULONG sector = 1; sector < header.UpdateSequenceCount; ++sector)
+    {
+        const auto last = reinterpret_cast<WORD*>(record + sector * FIXUP_STRIDE - sizeof(WORD));
+        if (*last != sequence[0]) return false;
+        *last = sequence[sector];
+    }
+    return true;
+}
+
+bool MftReader::DecodeRuns(const BYTE* runs, const BYTE* end, const ULONGLONG clusterSize, std::vector<EXTENT>& extents)
+{
+    // Each run starts with a byte holding the sizes of its length and of
+    // its signed offset relative to the previous run in the low and high nibble
+    LONGLONG cluster = 0;
+    while (runs < end && *runs != 0)
+    {
+        const ULONG lengthSize = *runs & 0x0F;
+        const ULONG offsetSize = *runs >> 4;
+        if (lengthSize == 0 || lengthSize > 8 || offsetSize > 8 || runs + 1 + lengthSize + offsetSize > end)
+        {
+            return false;
+        }
+
+        ULONGLONG length = 0;
+        for (ULONG i = 0; i < lengthSize; ++i) length |= static_cast<ULONGLONG>(runs[1 + i]) << (8 * i);
+        ULONGLONG offset = 0;
+        for (ULONG i = 0; i < offsetSize; ++i) offset |= static_cast<ULONGLONG>(runs[1 + lengthSize + i]) << (8 * i);
+        if (offsetSize > 0 && offsetSize < 8 && (runs[lengthSize + offsetSize] & 0x80) != 0)
+        {
+            offset |= ~0ull << (8 * offsetSize);
+        }
+        runs += 1 + lengthSize + offsetSize;
+
+        // The table is never sparse
+        if (offsetSize == 0) return false;
+        cluster += static_cast<LONGLONG>(offset);
+        extents.push_back({ static_cast<ULONGLONG>(cluster) * clusterSize, length * clusterSize });
+    }
+    return !extents.empty();
+}
@@ -0,0 +1,102 @@
+﻿// MftReader.h - Declaration of MftReader
+//
+// WinDirStat - Directory Statistics
+// Copyright © WinDirStat Team
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+
+#pragma once
+
+#include "stdafx.h"
+#include "SmartPointer.h"
+
+#include <stop_token>
+#include <string>
+#include <vector>
+
+//
+// MftReader. Reads the master file table of an NTFS volume sequentially in
+// large chunks instead of enumerating it directory by directory so the disk
+// does not have to seek between directories.  The volume can be a device
+// such as \\.\C: (which requires administrative rights) or an image file of
+// a volume.  Chunks are parsed in parallel while the next one is being read.
+// Each name of a file is returned as a separate link to its parent so the
+// caller can rebuild the directory tree from the parent references.
+//
+class MftReader final
+{
+public:
+
+    using MFTRECORD = struct MFTRECORD
+    {
+        ULONGLONG m_SizeLogical = 0;
+        ULONGLONG m_SizePhysical = 0;
+        FILETIME m_LastWrite = {};
+        DWORD m_Attributes = 0;
+        DWORD m_ReparseTag = 0;
+        bool m_InUse = false;
+    };
+
+    using MFTLINK = struct MFTLINK
+    {
+        ULONG m_Record;
+        ULONG m_Parent;
+        std::wstring m_Name;
+    };
+
+    static constexpr ULONG ROOT_RECORD = 5;        // Root directory of the volume
+    static constexpr ULONG FIRST_USER_RECORD = 16; // Records below are reserved for metadata files
+
+    MftReader() : m_File(CloseHandle) {}
+
+    // Opens the volume device or image file and locates the master file table
+    bool Open(const std::wstring& path);
+
+    // Reads all records indexed by record number and the names linking them;
+    // stops between chunks and returns false once a stop is requested
+    bool Read(std::vector<MFTRECORD>& records, std::vector<MFTLINK>& links, ULONG threads, std::stop_token stop = {});
+
+private:
+
+    using EXTENT = struct EXTENT
+    {
+        ULONGLONG m_Offset; // Bytes from the start of the volume
+        ULONGLONG m_Length; // Bytes
+    };
+
+    // Parts of a slice of records that cannot be stored in the slots of
+    // the slice itself since they belong to records parsed elsewhere
+    using SLICERESULT = struct SLICERESULT
+    {
+        std::vector<MFTLINK> m_Links;
+        std::vector<std::pair<ULONG, MFTRECORD>> m_Extensions; // Data sizes found in extension records
+    };
+
+    static constexpr ULONG CHUNK_SIZE = 4 * 1024 * 1024; // Bytes read at once
+
+    bool ReadRecords(ULONGLONG position, BYTE* buffer, ULONG size);
+    bool ReadAt(ULONGLONG offset, BYTE* buffer, ULONG size);
+    static bool ApplyFixups(BYTE* record, ULONG recordSize);
+    static bool DecodeRuns(const BYTE* runs, const BYTE* end, ULONGLONG clusterSize, std::vector<EXTENT>& extents);
+    void ParseSlice(BYTE* data, ULONG first, ULONG count, std::vector<MFTRECORD>& records, SLICERESULT& result) const;
+
+    SmartPointer<HANDLE> m_File;
+    ULONGLONG m_ClusterSize = 0;
+    ULONG m_RecordSize = 0;
+    ULONG m_RecordCount = 0;
+    std::vector<EXTENT> m_Extents; // Location of the master file table on the volume
+};
@@ -27,26 +27,38 @@
 
 #include <algorithm>
 
-bool CReparsePoints::IsReparseType(const std::wstring & longpath, const std::unordered_set<DWORD>& tagTypes, const bool mask)
+DWORD CReparsePoints::GetReparseTag(const std::wstring& longpath)
 {
+    // Prefer the tag returned with the directory entry; this opens the
+    // reparse point itself and is only needed when that is not available
     SmartPointer<HANDLE> handle(CloseHandle, CreateFile(longpath.c_str(), FILE_READ_ATTRIBUTES,
         FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
         FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OPEN_REPARSE_POINT, nullptr));
     if (handle == INVALID_HANDLE_VALUE)
     {
-        return false;
+        return 0;
     }
 
     std::vector<BYTE> buf(MAXIMUM_REPARSE_DATA_BUFFER_SIZE);
     DWORD dwRet = MAXIMUM_REPARSE_DATA_BUFFER_SIZE;
     if (DeviceIoControl(handle, FSCTL_GET_REPARSE_POINT,
         nullptr, 0, buf.data(), MAXIMUM_REPARSE_DATA_BUFFER_SIZE, &dwRet, nullptr) == FALSE)
+    {
+        return 0;
+    }
+
+    return reinterpret_cast<PREPARSE_GUID_DATA_BUFFER>(buf.data())->ReparseTag;
+}
+
+bool CReparsePoints::IsReparseType(const std::wstring & longpath, const std::unordered_set<DWORD>& tagTypes, const bool mask)
+{
+    const DWORD tag = GetReparseTag(longpath);
+    if (tag == 0)
     {
         return false;
     }
 
     // Test if the tag matches the types or mask that was passed
-    const DWORD tag = reinterpret_cast<PREPARSE_GUID_DATA_BUFFER>(buf.data())->ReparseTag;
     return std::ranges::any_of(tagTypes, [tag, mask](const DWORD& tagType) {
         return (mask && (tag & tagType) == tag) || (!mask && tag == tagType); });
 }
@@ -98,8 +110,8 @@ void CReparsePoints::Initialize()
             if (IsReparseType(name, { IO_REPARSE_TAG_MOUNT_POINT }))
             {
                 _wcslwr_s(name, len + 1);
-                m_Mountpoints.emplace_back(name);
-                m_Mountpoints.emplace_back(FileFindEnhanced::MakeLongPathCompatible(name));
+                m_Mountpoints.emplace(name);
+                m_Mountpoints.emplace(FileFindEnhanced::MakeLongPathCompatible(name));
             }
         }
     }
@@ -123,7 +135,7 @@ bool CReparsePoints::IsVolumeMountPoint(const std::wstring& longpath, DWORD attr
     if (attr == INVALID_FILE_ATTRIBUTES) attr = ::GetFileAttributes(longpath.c_str());
     if (!IsDirectoryReparsePoint(attr)) return false;
     std::wstring lowerpath = longpath;
-    return std::ranges::find(m_Mountpoints, MakeLower(lowerpath)) != m_Mountpoints.end();
+    return m_Mountpoints.contains(MakeLower(lowerpath));
 }
 
 bool CReparsePoints::IsJunction(const std::wstring& longpath, DWORD attr) const
@@ -26,7 +26,7 @@
 
 class CReparsePoints final
 {
-    std::vector<std::wstring> m_Mountpoints;
+    std::unordered_set<std::wstring> m_Mountpoints;
 
 public:
 
@@ -36,6 +36,7 @@ public:
     static bool IsSymbolicLink(const std::wstring& longpath, DWORD attr = INVALID_FILE_ATTRIBUTES);
     static bool IsCloudLink(const std::wstring& longpath, DWORD attr = INVALID_FILE_ATTRIBUTES);
     static bool IsReparseType(const std::wstring& longpath, const std::unordered_set<DWORD>& tagTypes, bool mask = false);
+    static DWORD GetReparseTag(const std::wstring& longpath);
     static bool IsDirectoryReparsePoint(DWORD attr);
     static bool IsReparsePoint(DWORD attr);
 };
@@ -0,0 +1,143 @@
+﻿// NamePool.h - Declaration of NamePool
+//
+// WinDirStat - Directory Statistics
+// Copyright © WinDirStat Team
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <new>
+#include <string_view>
+
+//
+// NamePool. Storage for item names.  Each thread appends to its own chunk so
+// names can be copied straight from the enumeration buffer without taking a
+// lock or allocating per name.  A name is referenced by a single pointer to
+// its null-terminated characters; the length is stored in the character
+// preceding them.  Chunks are aligned to their size so the chunk of a name
+// is found from its address; each counts the names it holds and is freed
+// once all of them have been released and no thread appends to it anymore.
+//
+class NamePool final
+{
+    static constexpr size_t CHUNK_BYTES = 64 * 1024; // allocation granularity of VirtualAlloc
+    static constexpr size_t MAX_LENGTH = USHRT_MAX;
+
+    struct Chunk final
+    {
+        std::atomic<size_t> m_Live; // names held plus one while a thread appends
+        size_t m_Bytes;
+
+        WCHAR* Begin()
+        {
+            return reinterpret_cast<WCHAR*>(this + 1);
+        }
+
+        WCHAR* End()
+        {
+            return reinterpret_cast<WCHAR*>(reinterpret_cast<BYTE*>(this) + m_Bytes);
+        }
+
+        static Chunk* Create(const size_t bytes, const size_t holders)
+        {
+            const auto storage = VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+            if (storage == nullptr) throw std::bad_alloc();
+            m_Reserved += bytes;
+            return new (storage) Chunk{ holders, bytes };
+        }
+
+        void Release()
+        {
+            if (m_Live.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+            m_Reserved -= m_Bytes;
+            VirtualFree(this, 0, MEM_RELEASE);
+        }
+    };
+
+    static_assert(sizeof(Chunk) % sizeof(WCHAR) == 0);
+
+    struct ThreadChunk final
+    {
+        Chunk* m_Chunk = nullptr;
+        WCHAR* m_Next = nullptr;
+
+        ~ThreadChunk()
+        {
+            if (m_Chunk != nullptr) m_Chunk->Release();
+        }
+    };
+
+    inline static std::atomic<ULONGLONG> m_Reserved = 0;
+
+public:
+
+    static LPCWSTR Intern(std::wstring_view name)
+    {
+        thread_local ThreadChunk chunk;
+
+        // room for the length prefix and the terminator
+        name = name.substr(0, MAX_LENGTH);
+        const size_t required = name.size() + 2;
+        const size_t bytes = sizeof(Chunk) + required * sizeof(WCHAR);
+
+        Chunk* target;
+        WCHAR* entry;
+        if (bytes > CHUNK_BYTES)
+        {
+            // names too long for a chunk get one of their own so that every
+            // name starts within the first allocation unit of its chunk
+            target = Chunk::Create((bytes + CHUNK_BYTES - 1) / CHUNK_BYTES * CHUNK_BYTES, 0);
+            entry = target->Begin();
+        }
+        else
+        {
+            if (chunk.m_Chunk == nullptr || static_cast<size_t>(chunk.m_Chunk->End() - chunk.m_Next) < required)
+            {
+                if (chunk.m_Chunk != nullptr) chunk.m_Chunk->Release();
+                chunk.m_Chunk = Chunk::Create(CHUNK_BYTES, 1);
+                chunk.m_Next = chunk.m_Chunk->Begin();
+            }
+            target = chunk.m_Chunk;
+            entry = chunk.m_Next;
+            chunk.m_Next += required;
+        }
+
+        entry[0] = static_cast<WCHAR>(name.size());
+        std::copy(name.begin(), name.end(), &entry[1]);
+        entry[required - 1] = L'\0';
+        target->m_Live.fetch_add(1, std::memory_order_relaxed);
+        return &entry[1];
+    }
+
+    static std::wstring_view Get(const LPCWSTR name)
+    {
+        return { name, static_cast<size_t>(name[-1]) };
+    }
+
+    // Releases a name returned by Intern(); it must not be referenced anymore
+    static void Release(const LPCWSTR name)
+    {
+        reinterpret_cast<Chunk*>(reinterpret_cast<uintptr_t>(name) & ~(CHUNK_BYTES - 1))->Release();
+    }
+
+    static ULONGLONG GetReserved()
+    {
+        return m_Reserved;
+    }
+};
@@ -55,7 +55,12 @@ Setting<bool> COptions::ListFullRowSelection(OptionsGeneral, L"ListFullRowSelect
 Setting<bool> COptions::ListGrid(OptionsGeneral, L"ListGrid", false);
 Setting<bool> COptions::ListStripes(OptionsGeneral, L"ListStripes", false);
 Setting<bool> COptions::PacmanAnimation(OptionsGeneral, L"PacmanAnimation", true);
+Setting<bool> COptions::ProcessHardlinks(OptionsGeneral, L"ProcessHardlinks", true);
+Setting<bool> COptions::ProcessSharedExtents(OptionsGeneral, L"ProcessSharedExtents", false);
 Setting<bool> COptions::ScanForDuplicates(OptionsDupeTree, L"ScanForDuplicates", false);
+Setting<bool> COptions::ScanningBackgroundMode(OptionsGeneral, L"ScanningBackgroundMode", false);
+Setting<bool> COptions::ScanningCache(OptionsGeneral, L"ScanningCache", false);
+Setting<bool> COptions::ScanningMasterFileTable(OptionsGeneral, L"ScanningMasterFileTable", false);
 Setting<bool> COptions::ShowColumnAttributes(OptionsFileTree, L"ShowColumnAttributes", false);
 Setting<bool> COptions::ShowColumnFiles(OptionsFileTree, L"ShowColumnFiles", true);
 Setting<bool> COptions::ShowColumnFolders(OptionsFileTree, L"ShowColumnFolders", false);
@@ -77,6 +82,7 @@ Setting<bool> COptions::SkipDupeDetectionCloudLinksWarning(OptionsGeneral, L"Ski
 Setting<bool> COptions::TreeMapGrid(OptionsTreeMap, L"TreeMapGrid", (CTreeMap::GetDefaults().grid));
 Setting<bool> COptions::UseBackupRestore(OptionsGeneral, L"UseBackupRestore", true);
 Setting<bool> COptions::UseWindowsLocaleSetting(OptionsGeneral, L"UseWindowsLocaleSetting", true);
+Setting<bool> COptions::WatchForChanges(OptionsGeneral, L"WatchForChanges", false);
 Setting<COLORREF> COptions::FileTreeColor0(OptionsFileTree, L"FileTreeColor0", RGB(64, 64, 140));
 Setting<COLORREF> COptions::FileTreeColor1(OptionsFileTree, L"FileTreeColor1", RGB(140, 64, 64));
 Setting<COLORREF> COptions::FileTreeColor2(OptionsFileTree, L"FileTreeColor2", RGB(64, 140, 64));
@@ -92,7 +98,11 @@ Setting<double> COptions::SubSplitterPos(OptionsGeneral, L"SubSplitterPos", -1.0
 Setting<int> COptions::ConfigPage(OptionsGeneral, L"ConfigPage", 0);
 Setting<int> COptions::LanguageId(OptionsGeneral, L"LanguageId", 0);
 Setting<int> COptions::LargeFileCount(OptionsGeneral, L"LargeFileCount", 50, 0, 10000);
+Setting<int> COptions::ScanningBackendMode(OptionsGeneral, L"ScanningBackendMode", 1, 0, 1);
+Setting<int> COptions::ScanningFolderLimit(OptionsGeneral, L"ScanningFolderLimit", 0, 0, 1000000);
+Setting<int> COptions::ScanningHashLimit(OptionsGeneral, L"ScanningHashLimit", 0, 0, 100000);
 Setting<int> COptions::ScanningThreads(OptionsGeneral, L"ScanningThreads", 4, 1, 16);
+Setting<int> COptions::ScanningThreadsTotal(OptionsGeneral, L"ScanningThreadsTotal", 16, 1, 64);
 Setting<int> COptions::SelectDrivesRadio(OptionsDriveSelect, L"SelectDrivesRadio", 0, 0, 2);
 Setting<int> COptions::FileTreeColorCount(OptionsFileTree, L"FileTreeColorCount", 8);
 Setting<int> COptions::FilteringSizeMinimum(OptionsGeneral, L"FilteringSizeMinimum", 0);
@@ -126,6 +136,8 @@ CTreeMap::Options COptions::TreeMapOptions;
 std::vector<USERDEFINEDCLEANUP> COptions::UserDefinedCleanups;
 std::vector<std::wregex> COptions::FilteringExcludeDirsRegex;
 std::vector<std::wregex> COptions::FilteringExcludeFilesRegex;
+GlobMatcher COptions::FilteringExcludeDirsMatcher;
+GlobMatcher COptions::FilteringExcludeFilesMatcher;
 ULONGLONG COptions::FilteringSizeMinimumCalculated;
 
 void COptions::SanitizeRect(RECT& rect)
@@ -187,18 +199,28 @@ void COptions::SetTreeMapOptions(const CTreeMap::Options& options)
 
 void COptions::CompileFilters()
 {
-    for (const auto & [optionString, optionRegex] : {
-        std::pair{FilteringExcludeDirs.Obj(), std::ref(FilteringExcludeDirsRegex)},
-        std::pair{FilteringExcludeFiles.Obj(), std::ref(FilteringExcludeFilesRegex)}})
+    for (const auto & [optionString, optionRegex, optionMatcher] : {
+        std::tuple{FilteringExcludeDirs.Obj(), std::ref(FilteringExcludeDirsRegex), std::ref(FilteringExcludeDirsMatcher)},
+        std::tuple{FilteringExcludeFiles.Obj(), std::ref(FilteringExcludeFilesRegex), std::ref(FilteringExcludeFilesMatcher)}})
     {
         std::wstringstream stream(optionString);
-        std::wstring token;
+        std::vector<std::wstring> tokens;
+        for (std::wstring token; std::getline(stream, token);)
+        {
+            while (!token.empty() && token.back() == L'\r') token.pop_back();
+            tokens.emplace_back(std::move(token));
+        }
+
+        // Globs are compiled into a single automaton; regular expressions and
+        // glob sets too complex for the automaton are matched one by one
+        optionRegex.get().clear();
+        if (!FilteringUseRegex && optionMatcher.get().Compile(tokens)) continue;
+        optionMatcher.get().Clear();
 
-        while (std::getline(stream, token))
+        for (const auto& token : tokens)
         {
             try
             {
-                while (!token.empty() && token.back() == L'\r') token.pop_back();
                 optionRegex.get().emplace_back(FilteringUseRegex ? token : GlobToRegex(token));
             }
             catch (const std::regex_error&)
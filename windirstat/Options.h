@@ -22,6 +22,7 @@
 
 #include "TreeMap.h"
 #include "Property.h"
+#include "GlobMatcher.h"
 
 #include <regex>
 
@@ -123,7 +124,12 @@ public:
     static Setting<bool> ListGrid;
     static Setting<bool> ListStripes;
     static Setting<bool> PacmanAnimation;
+    static Setting<bool> ProcessHardlinks;
+    static Setting<bool> ProcessSharedExtents;
     static Setting<bool> ScanForDuplicates;
+    static Setting<bool> ScanningBackgroundMode;
+    static Setting<bool> ScanningCache;
+    static Setting<bool> ScanningMasterFileTable;
     static Setting<bool> ShowColumnAttributes;
     static Setting<bool> ShowColumnFiles;
     static Setting<bool> ShowColumnFolders;
@@ -145,6 +151,7 @@ public:
     static Setting<bool> TreeMapGrid;
     static Setting<bool> UseBackupRestore;
     static Setting<bool> UseWindowsLocaleSetting;
+    static Setting<bool> WatchForChanges;
     static Setting<COLORREF> FileTreeColor0;
     static Setting<COLORREF> FileTreeColor1;
     static Setting<COLORREF> FileTreeColor2;
@@ -161,7 +168,11 @@ public:
     static Setting<int> FollowReparsePointMask;
     static Setting<int> LanguageId;
     static Setting<int> LargeFileCount;
+    static Setting<int> ScanningBackendMode;
+    static Setting<int> ScanningFolderLimit;
+    static Setting<int> ScanningHashLimit;
     static Setting<int> ScanningThreads;
+    static Setting<int> ScanningThreadsTotal;
     static Setting<int> SelectDrivesRadio;
     static Setting<int> FileTreeColorCount;
     static Setting<int> FilteringSizeMinimum;
@@ -195,6 +206,8 @@ public:
     static std::vector<USERDEFINEDCLEANUP> UserDefinedCleanups;
     static std::vector<std::wregex> FilteringExcludeDirsRegex;
     static std::vector<std::wregex> FilteringExcludeFilesRegex;
+    static GlobMatcher FilteringExcludeDirsMatcher;
+    static GlobMatcher FilteringExcludeFilesMatcher;
     static ULONGLONG FilteringSizeMinimumCalculated;
 
     static void SanitizeRect(RECT& rect);
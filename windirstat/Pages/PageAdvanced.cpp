@@ -52,6 +52,9 @@ void CPageAdvanced::DoDataExchange(CDataExchange* pDX)
     DDX_Check(pDX, IDC_EXCLUDE_PROTECTED_FILE, m_SkipProtectedFile);
     DDX_Text(pDX, IDC_LARGEST_FILE_COUNT, m_LargestFileCount);
     DDX_CBIndex(pDX, IDC_COMBO_THREADS, m_ScanningThreads);
+    DDX_Text(pDX, IDC_FOLDER_LIMIT, m_ScanningFolderLimit);
+    DDX_Text(pDX, IDC_HASH_LIMIT, m_ScanningHashLimit);
+    DDX_Check(pDX, IDC_BACKGROUND_MODE, m_ScanningBackgroundMode);
 }
 
 BEGIN_MESSAGE_MAP(CPageAdvanced, CPropertyPageEx)
@@ -66,6 +69,9 @@ BEGIN_MESSAGE_MAP(CPageAdvanced, CPropertyPageEx)
     ON_BN_CLICKED(IDC_EXCLUDE_SYMLINKS_FILE, OnSettingChanged)
     ON_BN_CLICKED(IDC_EXCLUDE_HIDDEN_FILE, OnSettingChanged)
     ON_BN_CLICKED(IDC_EXCLUDE_PROTECTED_FILE, OnSettingChanged)
+    ON_EN_CHANGE(IDC_FOLDER_LIMIT, OnSettingChanged)
+    ON_EN_CHANGE(IDC_HASH_LIMIT, OnSettingChanged)
+    ON_BN_CLICKED(IDC_BACKGROUND_MODE, OnSettingChanged)
     ON_BN_CLICKED(IDC_RESET_PREFERENCES, &CPageAdvanced::OnBnClickedResetPreferences)
 END_MESSAGE_MAP()
 
@@ -87,6 +93,9 @@ BOOL CPageAdvanced::OnInitDialog()
     m_UseBackupRestore = COptions::UseBackupRestore;
     m_ScanningThreads = COptions::ScanningThreads - 1;
     m_LargestFileCount = std::to_wstring(COptions::LargeFileCount.Obj()).c_str();
+    m_ScanningFolderLimit = std::to_wstring(COptions::ScanningFolderLimit.Obj()).c_str();
+    m_ScanningHashLimit = std::to_wstring(COptions::ScanningHashLimit.Obj()).c_str();
+    m_ScanningBackgroundMode = COptions::ScanningBackgroundMode;
 
     UpdateData(FALSE);
     return TRUE;
@@ -118,6 +127,17 @@ void CPageAdvanced::OnOK()
     COptions::UseBackupRestore = (FALSE != m_UseBackupRestore);
     COptions::ScanningThreads = m_ScanningThreads + 1;
     COptions::LargeFileCount = std::stoi(m_LargestFileCount.GetString());
+    COptions::ScanningBackgroundMode = (FALSE != m_ScanningBackgroundMode);
+
+    // Limits apply to a running scan as well
+    const int folderLimit = std::stoi(m_ScanningFolderLimit.GetString());
+    const int hashLimit = std::stoi(m_ScanningHashLimit.GetString());
+    if (folderLimit != COptions::ScanningFolderLimit || hashLimit != COptions::ScanningHashLimit)
+    {
+        COptions::ScanningFolderLimit = folderLimit;
+        COptions::ScanningHashLimit = hashLimit;
+        CDirStatDoc::GetDocument()->ApplyScanLimits();
+    }
 
     if (refreshAll)
     {
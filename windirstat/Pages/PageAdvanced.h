@@ -53,8 +53,11 @@ protected:
     BOOL m_SkipHiddenFile = FALSE;
     BOOL m_SkipProtectedFile = FALSE;
     BOOL m_UseBackupRestore = FALSE;
+    BOOL m_ScanningBackgroundMode = FALSE;
     int m_ScanningThreads = 0;
     CStringW m_LargestFileCount;
+    CStringW m_ScanningFolderLimit;
+    CStringW m_ScanningHashLimit;
 
     DECLARE_MESSAGE_MAP()
     afx_msg void OnSettingChanged();
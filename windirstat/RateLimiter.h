@@ -0,0 +1,74 @@
+﻿// RateLimiter.h - Declaration of RateLimiter
+//
+// WinDirStat - Directory Statistics
+// Copyright © WinDirStat Team
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+//
+// RateLimiter. A token bucket shared by the threads doing a kind of I/O.
+// Callers reserve the tokens they are about to use and are told how long to
+// wait before using them; reservations may overdraw the bucket so that large
+// requests are delayed rather than starved.  The bucket holds at most one
+// second worth of tokens.  A rate of zero disables the limit.
+//
+class RateLimiter final
+{
+    using clock = std::chrono::steady_clock;
+
+    std::mutex m_Mutex;
+    std::atomic<double> m_Rate = 0.0;
+    double m_Tokens = 0.0;
+    clock::time_point m_Updated = clock::now();
+
+public:
+
+    void SetRate(const double rate)
+    {
+        // Outstanding debt is forgiven so a raised limit applies immediately
+        std::lock_guard lock(m_Mutex);
+        m_Rate = std::max(rate, 0.0);
+        m_Tokens = m_Rate;
+        m_Updated = clock::now();
+    }
+
+    // Takes the tokens and returns when they may be used
+    clock::time_point Reserve(const double tokens)
+    {
+        if (m_Rate == 0.0) return clock::now();
+
+        std::lock_guard lock(m_Mutex);
+        const auto now = clock::now();
+        const double rate = m_Rate;
+        if (rate == 0.0) return now;
+
+        const std::chrono::duration<double> elapsed = now - m_Updated;
+        m_Tokens = std::min(rate, m_Tokens + elapsed.count() * rate) - tokens;
+        m_Updated = now;
+        if (m_Tokens >= 0.0) return now;
+
+        return now + std::chrono::duration_cast<clock::duration>(
+            std::chrono::duration<double>(-m_Tokens / rate));
+    }
+};
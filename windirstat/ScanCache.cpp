@@ -0,0 +1,369 @@
+﻿// ScanCache.cpp - Implementation of ScanCache
+//
+// WinDirStat - Directory Statistics
+// Copyright © WinDirStat Team
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#include "stdafx.h"
+
+#include "ScanCache.h"
+#include "GlobalHelpers.h"
+#include "Localization.h"
+#include "WinDirStat.h"
+#include "SmartPointer.h"
+
+#include <fstream>
+
+namespace
+{
+    // Fixed part of a packed entry; the name follows without a terminator
+    using PACKEDENTRY = struct PACKEDENTRY
+    {
+        FILE_ID_128 FileId;
+        ULONGLONG SizeLogical;
+        ULONGLONG SizePhysical;
+        FILETIME LastWriteTime;
+        DWORD Attributes;
+        DWORD ReparseTag;
+        DWORD NameLength;
+    };
+
+    // Fixed part of a directory in the cache file; the listing follows
+    using PACKEDDIRECTORY = struct PACKEDDIRECTORY
+    {
+        FILE_ID_128 DirectoryId;
+        FILE_ID_128 ParentId;
+        FILETIME LastWrite;
+        ULONG LastSeen;
+        ULONG Size;
+    };
+
+    using PACKEDHEADER = struct PACKEDHEADER
+    {
+        DWORD Magic;
+        DWORD Version;
+        ULONG Scan;
+        ULONG Count;
+    };
+}
+
+ScanCache& ScanCache::Get()
+{
+    static ScanCache cache;
+    return cache;
+}
+
+void ScanCache::Prepare(const std::wstring& path)
+{
+    ULONGLONG volume;
+    FILE_ID_128 directoryId;
+    if (GetDirectoryId(path, volume, directoryId)) GetVolume(volume);
+}
+
+ScanCache::Listing ScanCache::Lookup(const ULONGLONG volume, const FILE_ID_128& directoryId,
+    const FILE_ID_128& parentId, const FILETIME& lastWrite)
+{
+    auto& cache = GetVolume(volume);
+    const DIRECTORYKEY key = MakeKey(directoryId);
+    auto& shard = cache.GetShard(key);
+    std::lock_guard lock(shard.m_Mutex);
+    const auto record = shard.m_Directories.find(key);
+    if (record == shard.m_Directories.end() ||
+        CompareFileTime(&record->second.m_LastWrite, &lastWrite) != 0)
+    {
+        return nullptr;
+    }
+
+    // a directory that was moved keeps its listing under its new parent
+    record->second.m_LastSeen = cache.m_Scan;
+    if (const DIRECTORYKEY parent = MakeKey(parentId); parent != DIRECTORYKEY{}) record->second.m_Parent = parent;
+    return record->second.m_Entries;
+}
+
+void ScanCache::Store(const ULONGLONG volume, const FILE_ID_128& directoryId, const FILE_ID_128& parentId,
+    const FILETIME& lastWrite, std::vector<BYTE>&& entries)
+{
+    auto listing = std::make_shared<const std::vector<BYTE>>(std::move(entries));
+
+    auto& cache = GetVolume(volume);
+    const DIRECTORYKEY key = MakeKey(directoryId);
+    auto& shard = cache.GetShard(key);
+    std::lock_guard lock(shard.m_Mutex);
+    shard.m_Directories[key] = { lastWrite, cache.m_Scan, MakeKey(parentId), std::move(listing) };
+    cache.m_Changed = true;
+}
+
+void ScanCache::Save(const std::vector<std::wstring>& roots)
+{
+    std::lock_guard lock(m_Mutex);
+
+    // only a complete scan of a root has looked at every directory below it
+    // so only those directories age; refreshes of single folders do not
+    std::unordered_map<ULONGLONG, std::vector<DIRECTORYKEY>> scanned;
+    for (const auto& root : roots)
+    {
+        ULONGLONG volume;
+        FILE_ID_128 directoryId;
+        if (GetDirectoryId(root, volume, directoryId) && m_Volumes.contains(volume))
+        {
+            scanned[volume].push_back(MakeKey(directoryId));
+        }
+    }
+    for (const auto& [volume, keys] : scanned)
+    {
+        Age(*m_Volumes.at(volume), keys);
+    }
+
+    for (auto& [volume, cache] : m_Volumes)
+    {
+        if (!cache->m_Changed) continue;
+
+        if (!Write(GetCacheFile(volume), *cache))
+        {
+            VTRACE(L"Could not write scan cache for volume {:016X}", volume);
+        }
+        cache->m_Changed = false;
+    }
+}
+
+void ScanCache::Age(VOLUMECACHE& cache, const std::vector<DIRECTORYKEY>& roots)
+{
+    // directories are below a root if their chain of parents leads to it;
+    // the answer is remembered for every directory along the way
+    std::unordered_map<DIRECTORYKEY, DIRECTORYKEY, DIRECTORYHASH> parents;
+    for (const auto& shard : cache.m_Shards)
+    {
+        for (const auto& [key, record] : shard.m_Directories) parents.emplace(key, record.m_Parent);
+    }
+
+    std::unordered_map<DIRECTORYKEY, bool, DIRECTORYHASH> below;
+    const auto isBelow = [&](DIRECTORYKEY key)
+    {
+        std::vector<DIRECTORYKEY> chain;
+        bool result = false;
+        while (chain.size() <= parents.size())
+        {
+            if (std::ranges::find(roots, key) != roots.end()) { result = true; break; }
+            if (const auto known = below.find(key); known != below.end()) { result = known->second; break; }
+            const auto parent = parents.find(key);
+            if (parent == parents.end()) break;
+            chain.push_back(key);
+            key = parent->second;
+        }
+        for (const auto& visited : chain) below[visited] = result;
+        return result;
+    };
+
+    // forget directories below the roots that have not been seen for a
+    // while since they have most likely been deleted
+    for (auto& shard : cache.m_Shards)
+    {
+        std::erase_if(shard.m_Directories, [&](const auto& record)
+        {
+            return cache.m_Scan - record.second.m_LastSeen >= MAX_AGE && isBelow(record.first);
+        });
+    }
+
+    cache.m_Scan++;
+    cache.m_Changed = true;
+}
+
+void ScanCache::AppendEntry(std::vector<BYTE>& listing, const FileFindRecord& record)
+{
+    const PACKEDENTRY entry = { record.FileId, record.SizeLogical, record.SizePhysical,
+        record.LastWriteTime, record.Attributes, record.ReparseTag, static_cast<DWORD>(record.Name.size()) };
+    const auto fixed = reinterpret_cast<const BYTE*>(&entry);
+    const auto name = reinterpret_cast<const BYTE*>(record.Name.data());
+    listing.insert(listing.end(), fixed, fixed + sizeof(entry));
+    listing.insert(listing.end(), name, name + record.Name.size() * sizeof(WCHAR));
+}
+
+size_t ScanCache::ReadEntry(const std::vector<BYTE>& listing, const size_t offset, FileFindRecord& record)
+{
+    PACKEDENTRY entry;
+    std::memcpy(&entry, listing.data() + offset, sizeof(entry));
+    record.FileId = entry.FileId;
+    record.SizeLogical = entry.SizeLogical;
+    record.SizePhysical = entry.SizePhysical;
+    record.LastWriteTime = entry.LastWriteTime;
+    record.Attributes = entry.Attributes;
+    record.ReparseTag = entry.ReparseTag;
+
+    // entries are packed so the name is only aligned to the fixed part
+    static_assert(sizeof(PACKEDENTRY) % alignof(WCHAR) == 0);
+    record.Name = std::wstring_view(reinterpret_cast<LPCWSTR>(listing.data() + offset + sizeof(entry)), entry.NameLength);
+    return offset + sizeof(entry) + entry.NameLength * sizeof(WCHAR);
+}
+
+ScanCache::DIRECTORYKEY ScanCache::MakeKey(const FILE_ID_128& directoryId)
+{
+    DIRECTORYKEY key;
+    std::memcpy(&key.m_Low, directoryId.Identifier, sizeof(key.m_Low));
+    std::memcpy(&key.m_High, directoryId.Identifier + sizeof(key.m_Low), sizeof(key.m_High));
+    return key;
+}
+
+FILE_ID_128 ScanCache::MakeId(const DIRECTORYKEY& key)
+{
+    FILE_ID_128 directoryId;
+    std::memcpy(directoryId.Identifier, &key.m_Low, sizeof(key.m_Low));
+    std::memcpy(directoryId.Identifier + sizeof(key.m_Low), &key.m_High, sizeof(key.m_High));
+    return directoryId;
+}
+
+bool ScanCache::GetDirectoryId(const std::wstring& path, ULONGLONG& volume, FILE_ID_128& directoryId)
+{
+    SmartPointer<HANDLE> handle(CloseHandle, CreateFile(path.c_str(), FILE_READ_ATTRIBUTES,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr));
+
+    FILE_ID_INFO idInfo;
+    if (handle == INVALID_HANDLE_VALUE || GetFileInformationByHandleEx(handle, FileIdInfo, &idInfo, sizeof(idInfo)) == 0 ||
+        idInfo.VolumeSerialNumber == 0)
+    {
+        return false;
+    }
+
+    volume = idInfo.VolumeSerialNumber;
+    directoryId = idInfo.FileId;
+    return true;
+}
+
+ScanCache::VOLUMECACHE& ScanCache::GetVolume(const ULONGLONG volume)
+{
+    VOLUMECACHE* cache = nullptr;
+    {
+        std::shared_lock lock(m_Mutex);
+        if (const auto found = m_Volumes.find(volume); found != m_Volumes.end()) cache = found->second.get();
+    }
+    if (cache == nullptr)
+    {
+        std::lock_guard lock(m_Mutex);
+        auto& added = m_Volumes[volume];
+        if (added == nullptr) added = std::make_unique<VOLUMECACHE>();
+        cache = added.get();
+    }
+
+    // load the cache of the volume the first time it is used; only the
+    // threads needing this volume wait for it
+    std::call_once(cache->m_Loaded, [volume, cache]
+    {
+        const std::wstring file = GetCacheFile(volume);
+        if (GetFileAttributes(file.c_str()) == INVALID_FILE_ATTRIBUTES || Load(file, *cache)) return;
+
+        // drop a damaged cache so it is neither used nor read again
+        VTRACE(L"Discarding scan cache for volume {:016X}", volume);
+        DeleteFile(file.c_str());
+        for (auto& shard : cache->m_Shards) shard.m_Directories.clear();
+        cache->m_Scan = 1;
+    });
+    return *cache;
+}
+
+std::wstring ScanCache::GetCacheFile(const ULONGLONG volume)
+{
+    // keep the cache next to the settings when running portable
+    std::wstring folder = GetAppFolder();
+    if (!CDirStatApp::InPortableMode())
+    {
+        PWSTR appData = nullptr;
+        if (SUCCEEDED(SHGetKnownFolderPath(FOLDERID_LocalAppData, 0, nullptr, &appData)))
+        {
+            folder = std::wstring(appData) + L"\\" + Localization::Lookup(IDS_APP_TITLE);
+            CreateDirectory(folder.c_str(), nullptr);
+        }
+        CoTaskMemFree(appData);
+    }
+
+    return std::format(L"{}\\ScanCache-{:016X}.dat", folder, volume);
+}
+
+bool ScanCache::Load(const std::wstring& file, VOLUMECACHE& cache)
+{
+    std::ifstream stream(file, std::ios::binary | std::ios::ate);
+    if (!stream.is_open()) return false;
+    ULONGLONG remaining = static_cast<ULONGLONG>(stream.tellg());
+    stream.seekg(0);
+
+    PACKEDHEADER header;
+    if (!stream.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        header.Magic != FILE_MAGIC || header.Version != FILE_VERSION)
+    {
+        return false;
+    }
+    remaining -= sizeof(header);
+
+    // sizes read from the file are checked against what is left of it
+    // before anything is allocated for them
+    cache.m_Scan = header.Scan;
+    const size_t count = std::min<ULONGLONG>(header.Count, remaining / sizeof(PACKEDDIRECTORY));
+    for (auto& shard : cache.m_Shards) shard.m_Directories.reserve(count / DIRECTORY_SHARDS);
+    for (ULONG i = 0; i < header.Count; i++)
+    {
+        PACKEDDIRECTORY directory;
+        if (!stream.read(reinterpret_cast<char*>(&directory), sizeof(directory))) return false;
+        remaining -= sizeof(directory);
+        if (directory.Size > remaining || directory.Size > MAX_LISTING) return false;
+        remaining -= directory.Size;
+
+        std::vector<BYTE> entries(directory.Size);
+        if (!stream.read(reinterpret_cast<char*>(entries.data()), directory.Size)) return false;
+
+        // reject listings whose entries do not add up to their size
+        size_t offset = 0;
+        for (FileFindRecord record; offset + sizeof(PACKEDENTRY) <= entries.size();)
+        {
+            offset = ReadEntry(entries, offset, record);
+        }
+        if (offset != entries.size()) return false;
+
+        const DIRECTORYKEY key = MakeKey(directory.DirectoryId);
+        cache.GetShard(key).m_Directories[key] = { directory.LastWrite, directory.LastSeen, MakeKey(directory.ParentId),
+            std::make_shared<const std::vector<BYTE>>(std::move(entries)) };
+    }
+
+    return true;
+}
+
+bool ScanCache::Write(const std::wstring& file, const VOLUMECACHE& cache)
+{
+    // write to a temporary file and swap it in so a failed save keeps
+    // the previous cache intact
+    const std::wstring temporary = file + L".tmp";
+    {
+        std::ofstream stream(temporary, std::ios::binary | std::ios::trunc);
+        if (!stream.is_open()) return false;
+
+        size_t count = 0;
+        for (const auto& shard : cache.m_Shards) count += shard.m_Directories.size();
+        const PACKEDHEADER header = { FILE_MAGIC, FILE_VERSION, cache.m_Scan, static_cast<ULONG>(count) };
+        stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        for (const auto& shard : cache.m_Shards)
+        {
+            for (const auto& [key, record] : shard.m_Directories)
+            {
+                const PACKEDDIRECTORY directory = { MakeId(key), MakeId(record.m_Parent), record.m_LastWrite,
+                    record.m_LastSeen, static_cast<ULONG>(record.m_Entries->size()) };
+                stream.write(reinterpret_cast<const char*>(&directory), sizeof(directory));
+                stream.write(reinterpret_cast<const char*>(record.m_Entries->data()), static_cast<std::streamsize>(record.m_Entries->size()));
+            }
+        }
+
+        if (!stream.flush()) return false;
+    }
+
+    return MoveFileEx(temporary.c_str(), file.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+}
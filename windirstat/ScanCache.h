@@ -0,0 +1,133 @@
+﻿// ScanCache.h - Declaration of ScanCache
+//
+// WinDirStat - Directory Statistics
+// Copyright © WinDirStat Team
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#pragma once
+
+#include "stdafx.h"
+#include "FileFindBackend.h"
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//
+// ScanCache. Directory listings recorded while scanning and kept on disk per
+// volume so that a later scan can replay the entries of a directory whose
+// last write time has not changed instead of enumerating it again.  Listings
+// are keyed by the volume serial number and the full file identifier of the
+// directory so they survive renames and are distinct on ReFS.
+// The last write time of a directory only changes when entries are added,
+// removed or renamed so changes to the size of an existing file are missed.
+//
+class ScanCache final
+{
+public:
+
+    using Listing = std::shared_ptr<const std::vector<BYTE>>;
+
+    static ScanCache& Get();
+
+    // Loads the cache of the volume holding the path ahead of the scan
+    void Prepare(const std::wstring& path);
+
+    // Returns the recorded entries of the directory if it is unchanged
+    Listing Lookup(ULONGLONG volume, const FILE_ID_128& directoryId, const FILE_ID_128& parentId, const FILETIME& lastWrite);
+
+    // Records the complete list of entries of the directory
+    void Store(ULONGLONG volume, const FILE_ID_128& directoryId, const FILE_ID_128& parentId,
+        const FILETIME& lastWrite, std::vector<BYTE>&& entries);
+
+    // Writes the listings of the volumes changed since the last save; the
+    // listings below the roots passed that were completely scanned are aged
+    void Save(const std::vector<std::wstring>& roots);
+
+    // Conversion between backend records and the packed listing format;
+    // names of records read refer to the listing
+    static void AppendEntry(std::vector<BYTE>& listing, const FileFindRecord& record);
+    static size_t ReadEntry(const std::vector<BYTE>& listing, size_t offset, FileFindRecord& record);
+
+private:
+
+    using DIRECTORYKEY = struct DIRECTORYKEY
+    {
+        ULONGLONG m_Low = 0;
+        ULONGLONG m_High = 0;
+        bool operator==(const DIRECTORYKEY&) const = default;
+    };
+
+    using DIRRECORD = struct DIRRECORD
+    {
+        FILETIME m_LastWrite = {};
+        ULONG m_LastSeen = 0; // full scan in which the listing was last used
+        DIRECTORYKEY m_Parent; // directory the listing was last seen in if known
+        Listing m_Entries;
+    };
+
+    using DIRECTORYHASH = struct DIRECTORYHASH
+    {
+        size_t operator()(const DIRECTORYKEY& key) const noexcept
+        {
+            return std::hash<ULONGLONG>{}(key.m_Low) ^ std::hash<ULONGLONG>{}(key.m_High) * 31;
+        }
+    };
+
+    // Directories are sharded so scanning threads rarely wait on each other
+    using DIRSHARD = struct DIRSHARD
+    {
+        std::mutex m_Mutex;
+        std::unordered_map<DIRECTORYKEY, DIRRECORD, DIRECTORYHASH> m_Directories;
+    };
+    static constexpr size_t DIRECTORY_SHARDS = 16;
+
+    using VOLUMECACHE = struct VOLUMECACHE
+    {
+        std::array<DIRSHARD, DIRECTORY_SHARDS> m_Shards;
+        std::once_flag m_Loaded;
+        ULONG m_Scan = 1;              // full scan currently recording into this cache
+        std::atomic<bool> m_Changed = false; // listings were recorded or dropped since the last save
+
+        DIRSHARD& GetShard(const DIRECTORYKEY& key)
+        {
+            return m_Shards[DIRECTORYHASH{}(key) % DIRECTORY_SHARDS];
+        }
+    };
+
+    static constexpr DWORD FILE_MAGIC = 0x43534457; // WDSC
+    static constexpr DWORD FILE_VERSION = 4;
+    static constexpr ULONG MAX_AGE = 16; // full scans a listing may go unused before it is dropped
+    static constexpr ULONG MAX_LISTING = 256 * 1024 * 1024; // largest listing accepted from the file
+
+    static DIRECTORYKEY MakeKey(const FILE_ID_128& directoryId);
+    static FILE_ID_128 MakeId(const DIRECTORYKEY& key);
+    static bool GetDirectoryId(const std::wstring& path, ULONGLONG& volume, FILE_ID_128& directoryId);
+    static void Age(VOLUMECACHE& cache, const std::vector<DIRECTORYKEY>& roots);
+    VOLUMECACHE& GetVolume(ULONGLONG volume);
+    static std::wstring GetCacheFile(ULONGLONG volume);
+    static bool Load(const std::wstring& file, VOLUMECACHE& cache);
+    static bool Write(const std::wstring& file, const VOLUMECACHE& cache);
+
+    std::shared_mutex m_Mutex; // guards the set of volumes; each volume loads on its own
+    std::unordered_map<ULONGLONG, std::unique_ptr<VOLUMECACHE>> m_Volumes;
+};
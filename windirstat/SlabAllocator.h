@@ -0,0 +1,195 @@
+﻿// SlabAllocator.h - Declaration of SlabAllocator
+//
+// WinDirStat - Directory Statistics
+// Copyright © WinDirStat Team
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+//
+// SlabAllocator<>. Fixed size block allocator for the many small objects
+// created while scanning.  Each thread carves blocks out of its own slab and
+// keeps its own free list so the scanning threads do not contend on the heap.
+// Freed blocks beyond a batch are handed back to a shared list for reuse.
+// Slabs are only returned to the system as a whole by ReleaseAll() once
+// no blocks are in use anymore, e.g. after the whole tree has been deleted.
+//
+template <typename T, size_t SlabSize = 256 * 1024>
+class SlabAllocator final
+{
+    static constexpr size_t BlockAlign = alignof(T) > alignof(void*) ? alignof(T) : alignof(void*);
+    static constexpr size_t BlockSize = (sizeof(T) + BlockAlign - 1) / BlockAlign * BlockAlign;
+    static constexpr size_t BlocksPerSlab = SlabSize / BlockSize;
+    static constexpr size_t FreeBatch = 256;
+
+    static_assert(BlockAlign <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+    static_assert(BlocksPerSlab > 0);
+
+    struct ThreadCache final
+    {
+        std::byte* m_Next = nullptr;
+        std::byte* m_End = nullptr;
+        std::vector<void*> m_Free;
+        std::atomic<ptrdiff_t> m_Live = 0; // only written by the owning thread
+        size_t m_Generation = 0;
+
+        ThreadCache()
+        {
+            std::lock_guard lock(m_Mutex);
+            m_Caches.insert(this);
+        }
+
+        ~ThreadCache()
+        {
+            std::lock_guard lock(m_Mutex);
+            m_Caches.erase(this);
+            m_RetiredLive += m_Live;
+            if (m_Generation == m_CurrentGeneration)
+            {
+                m_SharedFree.insert(m_SharedFree.end(), m_Free.begin(), m_Free.end());
+            }
+        }
+
+        ThreadCache(const ThreadCache&) = delete;
+        ThreadCache& operator=(const ThreadCache&) = delete;
+
+        void AddLive(const ptrdiff_t count)
+        {
+            m_Live.store(m_Live.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+        }
+    };
+
+    inline static std::mutex m_Mutex;
+    inline static std::vector<std::unique_ptr<std::byte[]>> m_Slabs;
+    inline static std::vector<void*> m_SharedFree;
+    inline static std::unordered_set<ThreadCache*> m_Caches;
+    inline static ptrdiff_t m_RetiredLive = 0;
+    inline static std::atomic<size_t> m_CurrentGeneration = 1;
+
+    static ThreadCache& GetCache()
+    {
+        thread_local ThreadCache cache;
+
+        // blocks held from before a release refer to freed slabs
+        if (cache.m_Generation != m_CurrentGeneration.load(std::memory_order_acquire))
+        {
+            cache.m_Next = cache.m_End = nullptr;
+            cache.m_Free.clear();
+            cache.m_Generation = m_CurrentGeneration;
+        }
+        return cache;
+    }
+
+    static void Refill(ThreadCache& cache)
+    {
+        std::lock_guard lock(m_Mutex);
+
+        // prefer blocks released by other threads over growing
+        if (!m_SharedFree.empty())
+        {
+            const size_t count = std::min(FreeBatch, m_SharedFree.size());
+            cache.m_Free.insert(cache.m_Free.end(), m_SharedFree.end() - count, m_SharedFree.end());
+            m_SharedFree.resize(m_SharedFree.size() - count);
+            return;
+        }
+
+        auto& slab = m_Slabs.emplace_back(std::make_unique_for_overwrite<std::byte[]>(BlocksPerSlab * BlockSize));
+        cache.m_Next = slab.get();
+        cache.m_End = slab.get() + BlocksPerSlab * BlockSize;
+    }
+
+    static ptrdiff_t GetLiveLocked()
+    {
+        ptrdiff_t live = m_RetiredLive;
+        for (const auto& cache : m_Caches)
+        {
+            live += cache->m_Live.load(std::memory_order_relaxed);
+        }
+        return live;
+    }
+
+public:
+
+    static void* Allocate()
+    {
+        auto& cache = GetCache();
+        cache.AddLive(1);
+
+        if (cache.m_Free.empty() && cache.m_Next == cache.m_End)
+        {
+            Refill(cache);
+        }
+
+        if (!cache.m_Free.empty())
+        {
+            void* block = cache.m_Free.back();
+            cache.m_Free.pop_back();
+            return block;
+        }
+
+        void* block = cache.m_Next;
+        cache.m_Next += BlockSize;
+        return block;
+    }
+
+    static void Deallocate(void* block)
+    {
+        if (block == nullptr) return;
+
+        auto& cache = GetCache();
+        cache.AddLive(-1);
+        cache.m_Free.push_back(block);
+
+        // hand a batch to the shared list so memory freed on one thread
+        // can be reused by the threads that are still allocating
+        if (cache.m_Free.size() >= 2 * FreeBatch)
+        {
+            std::lock_guard lock(m_Mutex);
+            m_SharedFree.insert(m_SharedFree.end(), cache.m_Free.end() - FreeBatch, cache.m_Free.end());
+            cache.m_Free.resize(cache.m_Free.size() - FreeBatch);
+        }
+    }
+
+    // Returns all slabs to the system if no blocks are in use; the caller
+    // must ensure no other thread is allocating concurrently
+    static bool ReleaseAll()
+    {
+        std::lock_guard lock(m_Mutex);
+        if (GetLiveLocked() != 0) return false;
+
+        m_Slabs.clear();
+        m_Slabs.shrink_to_fit();
+        m_SharedFree.clear();
+        m_SharedFree.shrink_to_fit();
+        ++m_CurrentGeneration;
+        return true;
+    }
+
+    // Bytes reserved in slabs and bytes occupied by blocks in use
+    static void GetUsage(ULONGLONG& reserved, ULONGLONG& live)
+    {
+        std::lock_guard lock(m_Mutex);
+        reserved = static_cast<ULONGLONG>(m_Slabs.size()) * BlocksPerSlab * BlockSize;
+        live = static_cast<ULONGLONG>(std::max<ptrdiff_t>(GetLiveLocked(), 0)) * BlockSize;
+    }
+};
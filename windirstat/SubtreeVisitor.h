@@ -0,0 +1,116 @@
+﻿// SubtreeVisitor.h - Declaration of SubtreeVisitor
+//
+// WinDirStat - Directory Statistics
+// Copyright © WinDirStat Team
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+
+#pragma once
+
+#include "BlockingQueue.h"
+
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//
+// SubtreeVisitor<>. Visits every node of a tree using all processors.  Each
+// worker walks its subtree depth first and hands children with more than
+// SEQUENTIAL_CUTOFF descendants to the other workers; smaller trees are
+// walked on the calling thread alone.  Results are gathered per worker in a
+// State and combined by the merge function, which is called one at a time
+// whenever a worker finishes a subtree and before it hands one off, so that
+// whatever was gathered for a node is merged before anything below it that
+// is visited by another worker.  The node type must provide GetChildren()
+// and GetItemsCount(), the number of nodes below it.
+//
+template <typename T>
+class SubtreeVisitor final
+{
+    struct NoState final {};
+
+public:
+
+    static constexpr ULONGLONG SEQUENTIAL_CUTOFF = 16 * 1024;
+
+    // Calls visit(state, node) for every node; it returns whether to descend into the node
+    template <typename State, typename VisitFunction, typename MergeFunction>
+    static void Visit(T* root, VisitFunction visit, MergeFunction merge)
+    {
+        if (root == nullptr) return;
+
+        std::mutex mergeMutex;
+        const auto walk = [&](T* subtree, const std::function<void(T*)>& fork)
+        {
+            State state{};
+            const auto flush = [&]
+            {
+                std::lock_guard lock(mergeMutex);
+                merge(state);
+                state = State{};
+            };
+
+            std::vector<T*> stack = { subtree };
+            while (!stack.empty())
+            {
+                T* node = stack.back();
+                stack.pop_back();
+                if (!visit(state, node)) continue;
+
+                for (const auto& child : node->GetChildren())
+                {
+                    if (fork == nullptr || child->GetItemsCount() < SEQUENTIAL_CUTOFF)
+                    {
+                        stack.push_back(child);
+                        continue;
+                    }
+
+                    flush();
+                    fork(child);
+                }
+            }
+            flush();
+        };
+
+        if (root->GetItemsCount() < SEQUENTIAL_CUTOFF)
+        {
+            walk(root, nullptr);
+            return;
+        }
+
+        BlockingQueue<T*> queue;
+        const std::function<void(T*)> fork = [&queue](T* node) { queue.Push(node); };
+        queue.Push(root);
+        queue.StartThreads(std::max(std::thread::hardware_concurrency(), 1u), [&]
+        {
+            while (T* node = queue.Pop())
+            {
+                walk(node, fork);
+            }
+        });
+        queue.WaitForCompletion();
+        queue.CancelExecution();
+    }
+
+    // Calls visit(node) for every node; it returns whether to descend into the node
+    template <typename VisitFunction>
+    static void Visit(T* root, VisitFunction visit)
+    {
+        Visit<NoState>(root, [&visit](NoState&, T* node) { return visit(node); }, [](NoState&) {});
+    }
+};
@@ -99,6 +99,8 @@ void CFileTreeView::CreateColumns(const bool all)
         m_Control.InsertColumn(CHAR_MAX, Localization::Lookup(IDS_COL_ATTRIBUTES).c_str(), LVCFMT_LEFT, 50, COL_ATTRIBUTES);
     if (COptions::ShowColumnOwner)
         m_Control.InsertColumn(CHAR_MAX, Localization::Lookup(IDS_COL_OWNER).c_str(), LVCFMT_LEFT, 120, COL_OWNER);
+    if (COptions::ProcessSharedExtents)
+        m_Control.InsertColumn(CHAR_MAX, Localization::Lookup(IDS_COL_SIZE_EXCLUSIVE).c_str(), LVCFMT_RIGHT, 80, COL_SIZE_EXCLUSIVE);
 
     m_Control.OnColumnsInserted();
     
@@ -29,6 +29,7 @@
 #include "Localization.h"
 #include "PageFiltering.h"
 #include "SmartPointer.h"
+#include "Item.h"
 
 CIconHandler* GetIconHandler()
 {
@@ -131,15 +132,22 @@ void CDirStatApp::ReReadMountPoints()
     m_ReparsePoints.Initialize();
 }
 
-bool CDirStatApp::IsFollowingAllowed(const std::wstring& longpath, const DWORD attr) const
+bool CDirStatApp::IsFollowingAllowed(const std::wstring& longpath, const DWORD attr, DWORD tag) const
 {
     // Allow following if not a reparse point, is a reparse point without exclusion controls,
     // or is a reparse point with exclusion controls but are not excluded
-    return !CReparsePoints::IsReparsePoint(attr) ||
-        !CReparsePoints::IsReparseType(longpath, { IO_REPARSE_TAG_SYMLINK, IO_REPARSE_TAG_MOUNT_POINT }) ||
-        !COptions::ExcludeVolumeMountPoints && m_ReparsePoints.IsVolumeMountPoint(longpath, attr) ||
-        !COptions::ExcludeJunctions && m_ReparsePoints.IsJunction(longpath, attr) ||
-        !COptions::ExcludeSymbolicLinksDirectory && CReparsePoints::IsSymbolicLink(longpath, attr);
+    if (!CReparsePoints::IsReparsePoint(attr)) return true;
+
+    // The tag is passed from the directory entry when scanning so the
+    // reparse point only has to be opened when it is not known
+    if (tag == 0) tag = CReparsePoints::GetReparseTag(longpath);
+    if (tag == IO_REPARSE_TAG_SYMLINK) return !COptions::ExcludeSymbolicLinksDirectory;
+    if (tag != IO_REPARSE_TAG_MOUNT_POINT) return true;
+    if (!CReparsePoints::IsDirectoryReparsePoint(attr)) return false;
+
+    // Volume mount points and junctions share the same tag
+    return m_ReparsePoints.IsVolumeMountPoint(longpath, attr) ?
+        !COptions::ExcludeVolumeMountPoints : !COptions::ExcludeJunctions;
 }
 
 // Get the alternative colors for compressed and encrypted files/folders.
@@ -186,7 +194,19 @@ std::wstring CDirStatApp::GetCurrentProcessMemoryInfo()
     }
 
     static std::wstring memformat = L"     " + Localization::Lookup(IDS_RAMUSAGEs);
-    return Localization::Format(memformat, FormatBytes(pmc.WorkingSetSize));
+    std::wstring text = Localization::Format(memformat, FormatBytes(pmc.WorkingSetSize));
+
+    // Append the item allocator usage; unused space is what is held
+    // in free blocks and unused slab remainders
+    ULONGLONG reserved, live;
+    CItem::GetAllocatorUsage(reserved, live);
+    if (reserved > 0)
+    {
+        static std::wstring itemformat = L"     " + Localization::Lookup(IDS_ITEMMEMORYsss);
+        text += Localization::Format(itemformat, FormatBytes(live), FormatBytes(reserved),
+            (reserved - live) * 100 / reserved);
+    }
+    return text;
 }
 
 bool CDirStatApp::InPortableMode()
@@ -51,7 +51,7 @@ public:
     bool SetPortableMode(bool enable, bool onlyOpen = false);
 
     void ReReadMountPoints();
-    bool IsFollowingAllowed(const std::wstring& longpath, DWORD attr = 1) const;
+    bool IsFollowingAllowed(const std::wstring& longpath, DWORD attr = 1, DWORD tag = 0) const;
     CReparsePoints* GetReparseInfo() { return &m_ReparsePoints; }
 
     COLORREF AltColor() const;           // Coloring of compressed items
@@ -257,6 +257,12 @@
 #define IDS_MENU_CLEANUP_DISABLE_HIBERNATE 20255
 #define IDS_LARGEST_FILES             20256
 #define IDS_PAGE_ADVANCED_LARGEST_COUNT 20257
+#define IDS_ITEMMEMORYsss               20258
+#define IDS_COL_SIZE_EXCLUSIVE          20259
+#define IDS_SCANNING_THREADSs           20260
+#define IDS_PAGE_ADVANCED_FOLDER_LIMIT  20261
+#define IDS_PAGE_ADVANCED_HASH_LIMIT    20262
+#define IDS_PAGE_ADVANCED_BACKGROUND_MODE 20263
 
 // Next default values for new objects
 // 
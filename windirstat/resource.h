@@ -130,6 +130,9 @@
 #define IDC_FILTERING_MIN_UNITS         1241
 #define IDC_EDIT1                       1242
 #define IDC_LARGEST_FILE_COUNT          1242
+#define IDC_FOLDER_LIMIT                1243
+#define IDC_HASH_LIMIT                  1244
+#define IDC_BACKGROUND_MODE             1245
 #define ID_WDS_CONTROL                  4711
 #define ID_CLEANUP_EXPLORER_SELECT      32774
 #define ID_TREEMAP_ZOOMIN               32783
@@ -206,7 +209,7 @@
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NEXT_RESOURCE_VALUE        57353
 #define _APS_NEXT_COMMAND_VALUE         33074
-#define _APS_NEXT_CONTROL_VALUE         1243
+#define _APS_NEXT_CONTROL_VALUE         1246
 #define _APS_NEXT_SYMED_VALUE           109
 #endif
 #endif